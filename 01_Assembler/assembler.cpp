@@ -0,0 +1,649 @@
+//    Shaofan Lai, a LC2K-assembler
+//    Copyright (C) 2014  Shaofan Lai
+
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "assembler.h"
+
+#include <iostream>
+#include <fstream>
+
+#include <stdexcept>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <sstream>
+#include <thread>
+
+#include "../common/objfile.h"
+
+using std::vector;
+using std::string;
+using std::map;
+using std::set;
+
+using std::ostream;
+using std::ofstream;
+using std::ifstream;
+using std::stringstream;
+
+using std::cerr;
+using std::endl;
+using std::cout;
+using std::cin;
+
+// Configuration
+typedef Assembler::mc_t mc_t;
+const int REG_COUNT = 8;
+const int MEM_MAX = 0x7fff; 
+const int MEM_MIN = -0x8000;
+
+#define DEBUG(X) cout << "Debug:" << (X) << endl;
+#define DEBUGH(N) printf("Debug:%X\n", N);
+
+unsigned SymbolTable::hash(const Token &key)
+{
+    return lc2k_fnv32((const unsigned char *)key.ptr, key.len);
+}
+
+const int *SymbolTable::find(const Token &key) const
+{
+    size_t mask = _slots.size() - 1;
+    for (size_t i = hash(key) & mask; _slots[i].key.ptr; i = (i + 1) & mask)
+        if (_slots[i].key == key)
+            return &_slots[i].value;
+    return NULL;
+}
+
+bool SymbolTable::insert(const Token &key, int value)
+{
+    if (2 * (_size + 1) > _slots.size())
+    {
+        vector<Slot> old(2 * _slots.size());
+        old.swap(_slots);
+        _size = 0;
+        for (auto &slot: old)
+            if (slot.key.ptr)
+                insert(slot.key, slot.value);
+    }
+    size_t mask = _slots.size() - 1;
+    size_t i = hash(key) & mask;
+    for (; _slots[i].key.ptr; i = (i + 1) & mask)
+        if (_slots[i].key == key)
+            return false;
+    _slots[i].key = key;
+    _slots[i].value = value;
+    ++_size;
+    return true;
+}
+
+const char *const Assembler::_OPE_NAME[NUM_OPE] =
+    {"add", "nand", "lw", "sw", "beq", "jalr", "halt", "noop", ".fill"};
+const int Assembler::_FIELD_COUNT[NUM_OPE] = {3, 3, 3, 3, 3, 2, 0, 0, 1};
+
+// Perfect hash of the operator names: (4 * first + 9 * last + length) % 16
+// is distinct for all of them, so one compare confirms a hit.
+const signed char Assembler::_OPE_HASH[16] =
+    {NAND, LW, -1, -1, BEQ, -1, -1, -1, HALT, FILL, -1, ADD, NOOP, SW, JALR, -1};
+
+int Assembler::lookup_ope(const Token &t)
+{
+    if (t.len < 2 || t.len > 5)
+        return -1;
+    int ope = _OPE_HASH[(4 * (unsigned char)t.ptr[0]
+                         + 9 * (unsigned char)t.ptr[t.len - 1] + t.len) % 16];
+    return ope >= 0 && t == _OPE_NAME[ope] ? ope : -1;
+}
+
+// atoi() on a token that is not NUL-terminated, with glibc's saturation
+// on overflow, so that out-of-range numbers are diagnosed as before
+static int token_atoi(const Token &t)
+{
+    const char *p = t.ptr, *end = t.ptr + t.len;
+    bool neg = false;
+    if (p != end && (*p == '+' || *p == '-'))
+        neg = *p++ == '-';
+    unsigned long long limit = neg ? (unsigned long long)LONG_MAX + 1 : LONG_MAX;
+    unsigned long long value = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p)
+    {
+        value = value * 10 + (*p - '0');
+        if (value > limit)
+        {
+            value = limit;
+            for (; p != end && *p >= '0' && *p <= '9'; ++p) {}
+            break;
+        }
+    }
+    return (int)(long)(neg ? 0 - value : value);
+}
+
+mc_t Assembler::get_register(const Token &reg_name)
+{
+    int reg = token_atoi(reg_name);
+    if (reg < 0 || reg >= REG_COUNT || (!reg && reg_name != "0"))
+        throw SyntaxError("Invalid register: " + reg_name.str());
+    return reg & 0x00000007;
+}
+
+mc_t Assembler::encode_R(const Ins &ins)
+{
+    mc_t code = ins.ope,
+         regA = get_register(ins.fields[0]),
+         regB = get_register(ins.fields[1]),
+         destReg = get_register(ins.fields[2]);
+    return (code << 22) | (regA << 19) | (regB << 16) | destReg;
+}
+
+mc_t Assembler::get_offset(const Token &jmp, const int pc, bool *deferred)
+{
+    int offset = token_atoi(jmp);
+    //range test ?
+    if(offset == 0)
+        if (jmp!= "0")
+        {
+            const int *address = _labels.find(jmp);
+            if (!address && deferred)
+                return *deferred = true, 0;
+            if (!address)
+                throw SyntaxError("Invalid label: " + jmp.str());
+            offset = *address;
+            if (pc != -1)
+                offset = offset - pc - 1; 
+        }
+        else
+            throw SyntaxError("Invalid jumping: " + jmp.str());
+        else
+            if (offset > MEM_MAX || offset < MEM_MIN)
+                throw SyntaxError("Offset out of range: " + jmp.str());
+
+    return offset & 0x0000ffff;
+}
+
+mc_t Assembler::encode_I(const Ins &ins, const int pc, bool *deferred)
+{
+    mc_t code = ins.ope,
+         regA = get_register(ins.fields[0]),
+         regB = get_register(ins.fields[1]);
+    int offset = get_offset(ins.fields[2], ins.ope==BEQ?pc:-1, deferred);
+    return (code << 22) | (regA << 19) | (regB << 16) | offset;
+}
+
+mc_t Assembler::encode_J(const Ins &ins)
+{
+    mc_t code = ins.ope,
+         regA = get_register(ins.fields[0]),
+         regB = get_register(ins.fields[1]);
+    return (code << 22) | (regA << 19) | (regB << 16);
+}
+
+mc_t Assembler::encode_O(const Ins &ins)
+{
+    mc_t code = ins.ope;
+    return (code << 22);
+}
+
+mc_t Assembler::encode_DIR(const Ins &ins, bool *deferred)
+{
+    int data = token_atoi(ins.fields[0]);
+    if (!data && ins.fields[0] != "0")
+    {
+        const int *address = _labels.find(ins.fields[0]);
+        if (!address && deferred)
+            return *deferred = true, 0;
+        if (!address)
+            throw SyntaxError("Invalid label: " + ins.fields[0].str());
+        data = *address;
+    }
+
+    return data & 0xfffffffff;
+}
+
+
+void Assembler::reset()
+{
+    mapfile_close(&_file);
+    _src.clear();
+    _asm.clear();
+    _mc.clear();
+    _ins.clear();
+    _labels.clear();
+}
+
+void Assembler::loadFromFile(const string &filename)
+{
+    reset();
+    if (mapfile_open(&_file, filename.c_str()) != 0)
+        throw IOError("Can not open file: " + filename);
+
+    split_lines(_file.data, _file.data + _file.size);
+}
+
+void Assembler::import(const vector<string> &new_codes)
+{
+    reset();
+    for (auto &line: new_codes)
+        _src += line + '\n';
+    split_lines(_src.data(), _src.data() + _src.size());
+}
+
+void Assembler::import(const string &text)
+{
+    reset();
+    _src = text;
+    split_lines(_src.data(), _src.data() + _src.size());
+}
+
+// One token per non-empty line; the text must outlive _asm
+void Assembler::split_lines(const char *p, const char *end)
+{
+    while (p != end)
+    {
+        const char *eol = mapfile_eol(p, end);
+        if (eol != p)
+            _asm.push_back(Token(p, eol - p));
+        p = eol == end ? end : eol + 1;
+    }
+}
+
+// Splits like `stream >> string` in the C locale
+static inline bool next_token(const char *&p, const char *end, Token &t)
+{
+    p = mapfile_skip_space(p, end);
+    if (p == end)
+        return false;
+    const char *start = p;
+    while (p != end && !mapfile_isspace(*p))
+        ++p;
+    t = Token(start, p - start);
+    return true;
+}
+
+static string line_error(size_t lineno, const Token &line, const string &what)
+{
+    stringstream expbuffer;
+    expbuffer << "  error on line: " << lineno << '\n'
+              << "     " << line.str() << '\n'
+              << "  " << what << '\n';
+    return expbuffer.str();
+}
+
+void Assembler::parse_line(const Token &s, Ins &ins, size_t lineno)
+{
+    const char *p = s.ptr, *end = s.ptr + s.len;
+    Token temp;
+    int ope = -1;
+    bool ok = next_token(p, end, temp);
+    if (ok && (ope = lookup_ope(temp)) < 0)
+    {
+        ins.label = temp;
+        if ((ok = next_token(p, end, temp)))
+            ope = lookup_ope(temp);
+    }
+    if (ok && ope < 0)
+        throw SyntaxError(line_error(lineno, s, "Invalid opearator: " + temp.str()));
+    for (int i = 0; ok && i < _FIELD_COUNT[ope]; ++i)
+        ok = next_token(p, end, ins.fields[i]);
+    if (!ok)
+        throw SyntaxError(line_error(lineno, s,
+                          "Failed to recognize the structure of the operator"));
+    ins.ope = Ope(ope);
+}
+
+mc_t Assembler::encode_ins(const Ins &ins, int pc, bool *deferred)
+{
+    switch (ins.ope)
+    {
+        case ADD: case NAND:
+            return encode_R(ins);
+        case LW: case SW: case BEQ:
+            return encode_I(ins, pc, deferred);
+        case JALR:
+            return encode_J(ins);
+        case HALT: case NOOP:
+            return encode_O(ins);
+        default:
+            return encode_DIR(ins, deferred);
+    }
+}
+
+void Assembler::encode()
+{
+    //first scan    
+    _ins.reserve(_asm.size());
+    _mc.reserve(_asm.size());
+    int pc = 0x00000000;
+    for (auto &s: _asm)
+    {
+        Ins ins;
+        parse_line(s, ins, _ins.size()+1);
+
+        _ins.push_back(ins);
+        if (ins.label.len && !_labels.insert(ins.label, pc))
+            throw SyntaxError(line_error(_ins.size()+1, s,
+                                         "Duplicated label: " + ins.label.str()));
+
+        pc += 1;
+    }
+
+    //second scan
+    pc = 0x00000000;
+    for (auto &ins: _ins)
+        try
+        {
+            _mc.push_back(encode_ins(ins, pc));
+            pc += 1;
+        }
+        catch (SyntaxError e)
+        {
+            throw SyntaxError(line_error(pc+1, _asm[pc], e.what()));
+        }
+
+}
+
+// Encodes each line as it is parsed. References to labels that are not
+// defined yet leave a zero field and a fixup, patched once every label is
+// known. Diagnostics match encode(): a parse or duplicated-label error
+// anywhere wins over an encoding error, and among encoding errors the
+// lowest line wins, so the first one is only remembered until the scan
+// is over.
+void Assembler::encode_onepass()
+{
+    struct Fixup
+    {
+        int pc;
+        Ope ope;
+        Token label;
+    };
+    vector<Fixup> fixups;
+    int error_pc = -1;
+    string error;
+
+    _mc.reserve(_asm.size());
+    int pc = 0x00000000;
+    for (auto &s: _asm)
+    {
+        Ins ins;
+        parse_line(s, ins, pc+1);
+        if (ins.label.len && !_labels.insert(ins.label, pc))
+            throw SyntaxError(line_error(pc+2, s,
+                                         "Duplicated label: " + ins.label.str()));
+
+        mc_t code = 0;
+        if (error_pc < 0)
+            try
+            {
+                bool deferred = false;
+                code = encode_ins(ins, pc, &deferred);
+                if (deferred)
+                    fixups.push_back(Fixup{pc, ins.ope,
+                                           ins.fields[ins.ope == FILL ? 0 : 2]});
+            }
+            catch (SyntaxError & e)
+            {
+                error_pc = pc;
+                error = e.what();
+            }
+        _mc.push_back(code);
+        pc += 1;
+    }
+
+    // every fixup comes from a line before the first encoding error
+    for (auto &fix: fixups)
+    {
+        const int *address = _labels.find(fix.label);
+        if (!address)
+        {
+            error_pc = fix.pc;
+            error = "Invalid label: " + fix.label.str();
+            break;
+        }
+        if (fix.ope == BEQ)
+            _mc[fix.pc] |= (*address - fix.pc - 1) & 0x0000ffff;
+        else if (fix.ope == FILL)
+            _mc[fix.pc] = *address;
+        else
+            _mc[fix.pc] |= *address & 0x0000ffff;
+    }
+    if (error_pc >= 0)
+        throw SyntaxError(line_error(error_pc+1, _asm[error_pc], error));
+}
+
+// Runs f(begin, end, chunk) on `chunks` contiguous slices of [0, n), each
+// on its own thread.
+template <class F>
+static void run_chunks(size_t n, int chunks, F f)
+{
+    vector<std::thread> pool;
+    for (int c = 1; c < chunks; ++c)
+        pool.push_back(std::thread(f, n * c / chunks, n * (c + 1) / chunks, c));
+    f(0, n / chunks, 0);
+    for (auto &t: pool)
+        t.join();
+}
+
+// encode() over chunks of lines on several threads. Each chunk is parsed
+// on its own thread, stopping at its first error, and keeps its label
+// definitions in line order. The labels are merged into _labels in chunk
+// order, so the first duplicate found is the one encode() would report;
+// each chunk's parse error is reported only once every earlier label has
+// been merged. The chunks are then encoded in parallel straight into _mc,
+// and the error in the lowest chunk wins, which is the lowest line.
+void Assembler::encode_parallel(int threads)
+{
+    const size_t n = _asm.size();
+    const size_t MIN_CHUNK = 4096;
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    int chunks = (int)std::min<size_t>(threads, std::max<size_t>(1, n / MIN_CHUNK));
+
+    struct Chunk
+    {
+        vector<std::pair<Token, int> > labels;
+        size_t error_pc;
+        string error;
+    };
+    vector<Chunk> chunk(chunks);
+    _ins.resize(n);
+    _mc.resize(n);
+
+    //first scan
+    run_chunks(n, chunks, [&](size_t begin, size_t end, int c)
+    {
+        chunk[c].error_pc = n;
+        for (size_t pc = begin; pc < end; ++pc)
+        {
+            try
+            {
+                parse_line(_asm[pc], _ins[pc], pc+1);
+            }
+            catch (SyntaxError & e)
+            {
+                chunk[c].error_pc = pc;
+                chunk[c].error = e.what();
+                break;
+            }
+            if (_ins[pc].label.len)
+                chunk[c].labels.push_back(std::make_pair(_ins[pc].label, (int)pc));
+        }
+    });
+    for (auto &c: chunk)
+    {
+        for (auto &label: c.labels)
+            if (!_labels.insert(label.first, label.second))
+                throw SyntaxError(line_error(label.second+2, _asm[label.second],
+                                             "Duplicated label: " + label.first.str()));
+        if (c.error_pc != n)
+            throw SyntaxError(c.error);
+    }
+
+    //second scan
+    run_chunks(n, chunks, [&](size_t begin, size_t end, int c)
+    {
+        for (size_t pc = begin; pc < end; ++pc)
+            try
+            {
+                _mc[pc] = encode_ins(_ins[pc], pc);
+            }
+            catch (SyntaxError & e)
+            {
+                chunk[c].error_pc = pc;
+                chunk[c].error = line_error(pc+1, _asm[pc], e.what());
+                break;
+            }
+    });
+    for (auto &c: chunk)
+        if (c.error_pc != n)
+            throw SyntaxError(c.error);
+}
+
+void Assembler::output2stream(ostream &s, char mode)
+{
+    if (mode == 'H')
+        for_each(_mc.begin(), _mc.end(), [&s](mc_t &mc){printf("%X\n", mc);});
+    else
+        for_each(_mc.begin(), _mc.end(), [&s](mc_t &mc){s << mc << endl;});
+}
+
+void Assembler::saveToFile(const string &filename)
+{
+    ofstream output;
+    
+    try
+    {
+        output.open(filename);
+
+        for (auto &mc: _mc)
+            output << mc << '\n';
+        output << std::flush;
+
+        output.close();
+    }
+    catch (ofstream::failure)
+    {
+        throw IOError("Failed when write to file: " + filename);
+    }
+}
+
+vector<int> Assembler::source_lines() const
+{
+    vector<int> lines;
+    const char *p = _file.data ? _file.data : _src.data();
+    int lineno = 1;
+    for (auto &line: _asm)
+    {
+        for (; p != line.ptr; ++p)
+            if (*p == '\n')
+                ++lineno;
+        lines.push_back(lineno);
+    }
+    return lines;
+}
+
+// In address order, so that the output is deterministic
+vector<std::pair<int, Token> > Assembler::symbols() const
+{
+    vector<std::pair<int, Token> > symbols;
+    _labels.each([&symbols](const Token &name, int address)
+                 {
+                     symbols.push_back(std::make_pair(address, name));
+                 });
+    sort(symbols.begin(), symbols.end(),
+         [](const std::pair<int, Token> &a, const std::pair<int, Token> &b)
+         {
+             if (a.first != b.first)
+                 return a.first < b.first;
+             return a.second.str() < b.second.str();
+         });
+    return symbols;
+}
+
+void Assembler::saveObject(const string &filename)
+{
+    vector<std::pair<int, Token> > symbols;
+    for (auto &sym: this->symbols())
+        if (sym.second.len <= 0xffff)
+            symbols.push_back(sym);
+    size_t names = 0;
+    for (auto &sym: symbols)
+        names += sym.second.len;
+
+    vector<unsigned char> obj(obj_size(_mc.size(), symbols.size(), names));
+    unsigned char *p = obj_begin(&obj[0], _mc.size(), symbols.size());
+    for (auto &mc: _mc)
+    {
+        lc2k_put32(p, mc);
+        p += 4;
+    }
+    for (auto &sym: symbols)
+        p = obj_put_symbol(p, sym.first, sym.second.ptr, sym.second.len);
+    obj_seal(&obj[0], obj.size());
+
+    ofstream output(filename.c_str(), std::ios::binary);
+    if (!output.write((const char *)&obj[0], obj.size()))
+        throw IOError("Failed when write to file: " + filename);
+}
+
+
+
+
+
+
+
+
+//debug code
+void Assembler::pprint(const string &str)
+{
+    cout << '|';
+    for (int i = 31; i >= 0; --i)
+        printf("%02d|", i);
+    cout << endl << '|';
+    for_each(str.begin(), str.end(), [](char c){cout << ' ' << c << '|';});
+    cout << endl;
+}
+
+string Assembler::dec2bin(mc_t code)
+{
+    string s = "";
+    while (code)
+    {
+        s.push_back('0' + code % 2);
+        code /= 2;
+    }
+    s.resize(32, '0');
+    reverse(s.begin(), s.end());
+    return s;
+}
+
+void Assembler::test()
+{
+    Ins ins;
+    ins.ope = LW;
+    ins.fields[0] = "1";
+    ins.fields[1] = "2";
+    ins.fields[2] = "3";
+
+    pprint( dec2bin(encode_I(ins, 0)) );
+
+    encode();
+    output2stream(cout, 'H');
+}
@@ -0,0 +1,174 @@
+//    Shaofan Lai, a LC2K-assembler
+//    Copyright (C) 2014  Shaofan Lai
+
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LC2K_ASSEMBLER_H
+#define LC2K_ASSEMBLER_H
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstring>
+
+#include "../common/mapfile.h"
+
+class SyntaxError: public std::runtime_error
+{
+ public:
+    explicit SyntaxError(const std::string &s): runtime_error(s) {}
+};
+
+class IOError: public std::runtime_error
+{
+ public:
+    explicit IOError(const std::string &s): runtime_error(s) {}
+};
+
+// A slice of the source buffer. Tokens are never copied out of it; only
+// error messages turn one into a string.
+struct Token
+{
+    const char *ptr;
+    int len;
+
+    Token(): ptr(NULL), len(0) {}
+    Token(const char *p, int n): ptr(p), len(n) {}
+    Token(const char *s): ptr(s), len(strlen(s)) {}
+
+    bool operator==(const Token &t) const
+    { return len == t.len && !memcmp(ptr, t.ptr, len); }
+    bool operator!=(const Token &t) const { return !(*this == t); }
+    std::string str() const { return std::string(ptr, len); }
+};
+
+// Open addressing table from label to address, keyed by tokens that point
+// into the source buffer.
+class SymbolTable
+{
+    struct Slot
+    {
+        Token key;
+        int value;
+    };
+
+ public:
+    SymbolTable(): _size(0) { _slots.resize(64); }
+    void clear() { _slots.assign(64, Slot()); _size = 0; }
+    // NULL when the label is not defined
+    const int *find(const Token &key) const;
+    // false when the label is already defined
+    bool insert(const Token &key, int value);
+    template <class F> void each(F f) const
+    {
+        for (auto &slot: _slots)
+            if (slot.key.ptr)
+                f(slot.key, slot.value);
+    }
+
+ private:
+    static unsigned hash(const Token &key);
+    std::vector<Slot> _slots;
+    size_t _size;
+};
+
+class Assembler
+{
+ public:
+    typedef int mc_t;
+
+ private:
+    // Operators in opcode order; .fill is the only directive
+    enum Ope {ADD, NAND, LW, SW, BEQ, JALR, HALT, NOOP, FILL, NUM_OPE};
+
+    struct Ins
+    {
+        Token label;
+        Ope ope;
+        Token fields[3];
+    };
+
+ private:
+    // Instruction sets
+    static const char *const _OPE_NAME[NUM_OPE];
+    static const int _FIELD_COUNT[NUM_OPE];
+    static const signed char _OPE_HASH[16];
+    static int lookup_ope(const Token &);
+
+    // Encoding functions. With `deferred`, a label that is not defined
+    // yet sets it and encodes as 0 instead of being an error.
+    inline mc_t encode_R(const Ins &);
+    inline mc_t encode_I(const Ins &, int, bool *deferred = NULL);
+    inline mc_t encode_J(const Ins &);
+    inline mc_t encode_O(const Ins &);
+    inline mc_t encode_DIR(const Ins &, bool *deferred = NULL);
+    mc_t encode_ins(const Ins &, int, bool *deferred = NULL);
+    void parse_line(const Token &, Ins &, size_t);
+
+    // Utilities functions
+    mc_t get_register(const Token &);
+    mc_t get_offset(const Token &, const int pc = -1, bool *deferred = NULL);
+
+    // Storage: the source file mapped whole (or imported lines copied into
+    // _src), one token per non-empty line
+    MapFile _file;
+    std::string _src;
+    std::vector<Token> _asm;
+    std::vector<mc_t> _mc;
+    std::vector<Ins> _ins;
+
+    // Auxiliary data
+    SymbolTable _labels;
+
+    void split_lines(const char *, const char *);
+
+ public:
+    Assembler() { _file.data = NULL; _file.size = 0; _file.mapped = 0; }
+    ~Assembler() { mapfile_close(&_file); }
+    Assembler(const Assembler &) = delete;
+    Assembler & operator=(const Assembler &) = delete;
+
+    // Encoding procedure
+    void reset();
+    void import(const std::vector<std::string> &);
+    void import(const std::string &text);  // a whole source in memory
+    void encode();
+    void encode_onepass();  // same output and diagnostics in a single scan
+    void encode_parallel(int threads = 0);  // 0: one thread per core
+
+    // Code transfer
+    std::string get_mc();  
+    void loadFromFile(const std::string &);
+    void saveToFile(const std::string &);
+    void saveObject(const std::string &);  // binary object with symbol table
+    const std::vector<mc_t> &get_code() const { return _mc; }
+    size_t line_count() const { return _asm.size(); }
+
+    // Source information for listings: the text of the line that encodes
+    // word `pc`, the 1-based file line of every word, and the labels in
+    // address order
+    const Token &source(size_t pc) const { return _asm[pc]; }
+    std::vector<int> source_lines() const;
+    std::vector<std::pair<int, Token> > symbols() const;
+    void output2stream(std::ostream &s, char mode = 'D');  // D:dec H:Hex
+
+    // Debug tools
+    void test();
+    void pprint(const std::string &str);
+    std::string dec2bin(const mc_t code);
+};
+
+#endif
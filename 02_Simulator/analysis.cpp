@@ -0,0 +1,865 @@
+#include "analysis.h"
+
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+typedef Simulator::word_t word_t;
+typedef Simulator::Decoded Decoded;
+
+enum { ADD, NAND, LW, SW, BEQ, JALR, HALT, NOOP };
+
+static const char * const OPCODES[] = {"add", "nand", "lw", "sw", "beq", "jalr", "halt", "noop"};
+
+Analysis::Analysis(const word_t * words, int count):
+    _words(words, words + count), _block_at(count, -1)
+{
+    vector<char> reached, leader;
+    findReachable(reached, leader);
+    for (int pc = 0; pc < count; )
+    {
+        if (!reached[pc])
+        {
+            ++pc;
+            continue;
+        }
+        Block block;
+        block.begin = pc;
+        block.leaves = block.indirect = false;
+        do
+            _block_at[pc++] = _blocks.size();
+        while (pc < count && reached[pc] && !leader[pc]);
+        block.end = pc;
+        _blocks.push_back(block);
+    }
+
+    for (auto & block: _blocks)
+    {
+        const int last = block.end - 1;
+        const Decoded ins = Simulator::decode(_words[last]);
+        vector<int> targets;
+        if (ins.opcode == BEQ)
+        {
+            targets.push_back(last + 1 + ins.offset);
+            if (ins.regA != ins.regB)
+                targets.push_back(last + 1);
+        }
+        else if (ins.opcode == JALR)
+        {
+            // a call continues after the callee returns; anything else
+            // counts as a return and ends the path here
+            block.indirect = true;
+            if (leader[last + 1] == 2)
+                targets.push_back(last + 1);
+        }
+        else if (ins.opcode != HALT)
+            targets.push_back(last + 1);
+        for (int target: targets)
+        {
+            if (target < 0 || target >= count)
+                block.leaves = true;
+            else if (find(block.succ.begin(), block.succ.end(), _block_at[target]) == block.succ.end())
+                block.succ.push_back(_block_at[target]);
+        }
+    }
+    findDominators();
+    findLoops();
+}
+
+// The register a jalr at `pc` jumps through was last written in the same
+// straight-line run by `lw 0 r addr`: the callee is the word at addr.
+// Returns -1 when the target is not known that way.
+static int callTarget(const vector<word_t> & words, int pc)
+{
+    const int reg = Simulator::decode(words[pc]).regA;
+    for (int p = pc - 1; p >= 0; --p)
+    {
+        const Decoded ins = Simulator::decode(words[p]);
+        if (ins.opcode == BEQ || ins.opcode == JALR || ins.opcode == HALT)
+            return -1;
+        int wrote = -1;
+        if (ins.opcode == ADD || ins.opcode == NAND)
+            wrote = ins.destReg;
+        else if (ins.opcode == LW)
+            wrote = ins.regB;
+        if (wrote != reg)
+            continue;
+        if (ins.opcode != LW || ins.regA != 0 || ins.offset < 0 || ins.offset >= (int)words.size())
+            return -1;
+        const int target = words[ins.offset];
+        return target >= 0 && target < (int)words.size() ? target : -1;
+    }
+    return -1;
+}
+
+// Marks the words reachable from pc 0 and the ones that start a block; the
+// word after a call gets leader 2 so the block before it knows to fall
+// through.
+void Analysis::findReachable(vector<char> & reached, vector<char> & leader)
+{
+    const int count = _words.size();
+    reached.assign(count + 1, 0);
+    leader.assign(count + 1, 0);
+    vector<int> work;
+    if (count > 0)
+    {
+        work.push_back(0);
+        leader[0] = 1;
+    }
+    auto branchTo = [&](int target)
+    {
+        if (target >= 0 && target < count)
+        {
+            leader[target] = max<char>(leader[target], 1);
+            work.push_back(target);
+        }
+    };
+    while (!work.empty())
+    {
+        int pc = work.back();
+        work.pop_back();
+        for (; pc < count && !reached[pc]; ++pc)
+        {
+            reached[pc] = 1;
+            const Decoded ins = Simulator::decode(_words[pc]);
+            if (ins.opcode == BEQ)
+            {
+                branchTo(pc + 1 + ins.offset);
+                leader[pc + 1] = max<char>(leader[pc + 1], 1);
+                if (ins.regA == ins.regB)
+                    break;
+            }
+            else if (ins.opcode == JALR)
+            {
+                const int target = callTarget(_words, pc);
+                if (target < 0)
+                {
+                    leader[pc + 1] = max<char>(leader[pc + 1], 1);
+                    break;
+                }
+                if (find(_indirect.begin(), _indirect.end(), target) == _indirect.end())
+                    _indirect.push_back(target);
+                branchTo(target);
+                leader[pc + 1] = 2;
+            }
+            else if (ins.opcode == HALT)
+            {
+                leader[pc + 1] = max<char>(leader[pc + 1], 1);
+                break;
+            }
+        }
+    }
+    sort(_indirect.begin(), _indirect.end());
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm over reverse postorder.
+// Block 0 and every callee are roots, tied together by a virtual root.
+void Analysis::findDominators()
+{
+    const int n = _blocks.size();
+    vector<vector<int> > preds(n);
+    for (int b = 0; b < n; ++b)
+        for (int s: _blocks[b].succ)
+            preds[s].push_back(b);
+    vector<int> roots;
+    if (n)
+        roots.push_back(0);
+    for (int target: _indirect)
+        if (_block_at[target] > 0)
+            roots.push_back(_block_at[target]);
+
+    vector<int> order, rpo(n, -1);
+    vector<char> seen(n, 0);
+    for (int root: roots)
+    {
+        if (seen[root])
+            continue;
+        // iterative depth-first search for the postorder
+        vector<pair<int, size_t> > stack(1, make_pair(root, 0));
+        seen[root] = 1;
+        while (!stack.empty())
+        {
+            const int b = stack.back().first;
+            size_t & next = stack.back().second;
+            if (next < _blocks[b].succ.size())
+            {
+                const int s = _blocks[b].succ[next++];
+                if (!seen[s])
+                {
+                    seen[s] = 1;
+                    stack.push_back(make_pair(s, 0));
+                }
+                continue;
+            }
+            order.push_back(b);
+            stack.pop_back();
+        }
+    }
+    reverse(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i)
+        rpo[order[i]] = i;
+
+    const int VIRTUAL = n;
+    _idom.assign(n + 1, -1);
+    _idom[VIRTUAL] = VIRTUAL;
+    for (int root: roots)
+        _idom[root] = VIRTUAL;
+    auto intersect = [&](int a, int b)
+    {
+        while (a != b)
+        {
+            while (a != VIRTUAL && (b == VIRTUAL || rpo[a] > rpo[b]))
+                a = _idom[a];
+            while (b != VIRTUAL && (a == VIRTUAL || rpo[b] > rpo[a]))
+                b = _idom[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+        for (int b: order)
+        {
+            if (_idom[b] == VIRTUAL)
+                continue;
+            int dom = -1;
+            for (int p: preds[b])
+                if (_idom[p] >= 0)
+                    dom = dom < 0 ? p : intersect(p, dom);
+            if (dom >= 0 && dom != _idom[b])
+            {
+                _idom[b] = dom;
+                changed = true;
+            }
+        }
+    }
+    _idom.pop_back();
+    for (int b = 0; b < n; ++b)
+        if (_idom[b] == VIRTUAL)
+            _idom[b] = b;
+}
+
+// A natural loop per header: every edge to a block that dominates its
+// source closes one, and the body is what reaches the source backwards
+// without passing the header.
+void Analysis::findLoops()
+{
+    const int n = _blocks.size();
+    vector<vector<int> > preds(n);
+    for (int b = 0; b < n; ++b)
+        for (int s: _blocks[b].succ)
+            preds[s].push_back(b);
+    auto dominates = [&](int a, int b)
+    {
+        for (;;)
+        {
+            if (a == b)
+                return true;
+            if (_idom[b] == b)
+                return false;
+            b = _idom[b];
+        }
+    };
+    for (int h = 0; h < n; ++h)
+    {
+        vector<char> body(n, 0);
+        vector<int> work;
+        int latch = -1;
+        for (int p: preds[h])
+            if (dominates(h, p))
+            {
+                latch = max(latch, _blocks[p].end - 1);
+                if (!body[p])
+                {
+                    body[p] = 1;
+                    work.push_back(p);
+                }
+            }
+        if (latch < 0)
+            continue;
+        body[h] = 1;
+        while (!work.empty())
+        {
+            const int b = work.back();
+            work.pop_back();
+            if (b == h)
+                continue;
+            for (int p: preds[b])
+                if (!body[p])
+                {
+                    body[p] = 1;
+                    work.push_back(p);
+                }
+        }
+        Loop loop;
+        loop.head = _blocks[h].begin;
+        loop.latch = latch;
+        loop.size = 0;
+        loop.pure = true;
+        for (int b = 0; b < n; ++b)
+        {
+            if (!body[b])
+                continue;
+            loop.blocks.push_back(b);
+            loop.size += _blocks[b].end - _blocks[b].begin;
+            for (int pc = _blocks[b].begin; pc < _blocks[b].end; ++pc)
+            {
+                const int opcode = Simulator::decode(_words[pc]).opcode;
+                if (opcode != ADD && opcode != NAND && opcode != BEQ && opcode != NOOP)
+                    loop.pure = false;
+            }
+        }
+        // head first, then address order
+        rotate(loop.blocks.begin(), find(loop.blocks.begin(), loop.blocks.end(), h), loop.blocks.end());
+        sort(loop.blocks.begin() + 1, loop.blocks.end());
+        _loops.push_back(loop);
+    }
+}
+
+LoopSummary::LoopSummary(const Analysis & analysis, const Analysis::Loop & loop):
+    _head(loop.head), _latch(loop.latch), _spine(0), _jump(false)
+{
+    for (int r = 0; r < NUMREGS; ++r)
+    {
+        _end[r] = affine(r);
+        _row[r] = INVARIANT;
+        _acc[r] = false;
+    }
+    for (int b: loop.blocks)
+        for (int pc = analysis.blocks()[b].begin; pc < analysis.blocks()[b].end; ++pc)
+        {
+            const int opcode = Simulator::decode(analysis.word(pc)).opcode;
+            if (opcode != ADD && opcode != NAND && opcode != BEQ && opcode != NOOP)
+            {
+                _why = string(OPCODES[opcode]) + " at " + to_string(pc);
+                return;
+            }
+        }
+    if (loop.size != _latch - _head + 1 || analysis.blocks()[loop.blocks.back()].end != _latch + 1)
+        _why = "body is not one range of words";
+    else
+        build(analysis);
+}
+
+int LoopSummary::affine(int reg)
+{
+    Expr e = {AFFINE, -1, -1, {0}, (unsigned char)(1 << reg)};
+    e.c[reg] = 1;
+    _expr.push_back(e);
+    return _expr.size() - 1;
+}
+
+int LoopSummary::combine(Kind kind, int a, int b)
+{
+    const Expr & x = _expr[a], & y = _expr[b];
+    Expr e = {kind, a, b, {0}, (unsigned char)(x.uses | y.uses)};
+    if (x.kind == AFFINE && y.kind == AFFINE && kind == SUM)
+    {
+        e.kind = AFFINE;
+        for (int i = 0; i <= NUMREGS; ++i)
+            e.c[i] = x.c[i] + y.c[i];
+    }
+    else if (x.kind == AFFINE && a == b && kind == NOT_AND)
+    {
+        // nand of a value with itself is ~x = -x - 1
+        e.kind = AFFINE;
+        for (int i = 0; i <= NUMREGS; ++i)
+            e.c[i] = -x.c[i];
+        e.c[NUMREGS] -= 1;
+    }
+    if (e.kind == AFFINE)
+    {
+        e.uses = 0;
+        for (int r = 0; r < NUMREGS; ++r)
+            if (e.c[r])
+                e.uses |= 1 << r;
+    }
+    _expr.push_back(e);
+    return _expr.size() - 1;
+}
+
+// Walks the body once, symbolically: the spine is every instruction that
+// runs in each iteration, and each guard's range runs only when its beq
+// falls through.
+void LoopSummary::build(const Analysis & analysis)
+{
+    int cur[NUMREGS];
+    for (int r = 0; r < NUMREGS; ++r)
+        cur[r] = r;
+    for (int pc = _head; pc <= _latch; )
+    {
+        const Decoded ins = Simulator::decode(analysis.word(pc));
+        ++_spine;
+        if (ins.opcode == ADD || ins.opcode == NAND)
+            cur[ins.destReg] = combine(ins.opcode == ADD ? SUM : NOT_AND, cur[ins.regA], cur[ins.regB]);
+        if (ins.opcode != BEQ)
+        {
+            ++pc;
+            continue;
+        }
+
+        const int target = pc + 1 + ins.offset;
+        Exit exit = {pc, target, cur[ins.regA], cur[ins.regB], true, _spine, {0}};
+        copy(cur, cur + NUMREGS, exit.state);
+        if (pc == _latch)
+        {
+            if (ins.regA != ins.regB)
+            {
+                exit.target = _latch + 1;
+                exit.whenEqual = false;
+                _exits.push_back(exit);
+            }
+            break;
+        }
+        if (target < _head || target > _latch)
+            _exits.push_back(exit);
+        else if (target <= pc)
+        {
+            _why = "branch back from " + to_string(pc) + " before the latch";
+            return;
+        }
+        else if (target > pc + 1)
+        {
+            if (ins.regA == ins.regB)
+            {
+                _why = "unconditional jump at " + to_string(pc);
+                return;
+            }
+            Guard guard = {pc, cur[ins.regA], cur[ins.regB], target - pc - 1, {}};
+            for (int q = pc + 1; q < target; ++q)
+            {
+                const Decoded add = Simulator::decode(analysis.word(q));
+                if (add.opcode == NOOP)
+                    continue;
+                const int other = add.destReg == add.regA ? add.regB : add.regA;
+                if (add.opcode != ADD || (add.destReg != add.regA && add.destReg != add.regB)
+                    || other == add.destReg)
+                {
+                    _why = "guarded " + string(OPCODES[add.opcode]) + " at " + to_string(q)
+                         + " is not an accumulation";
+                    return;
+                }
+                guard.adds.push_back(make_pair((int)add.destReg, cur[other]));
+                _acc[add.destReg] = true;
+            }
+            _guards.push_back(guard);
+            pc = target;
+            continue;
+        }
+        ++pc;
+    }
+    if (_exits.empty())
+    {
+        _why = "no exit";
+        return;
+    }
+    copy(cur, cur + NUMREGS, _end);
+
+    // An accumulator is only ever read by the adds into it
+    unsigned accs = 0;
+    for (int r = 0; r < NUMREGS; ++r)
+        if (_acc[r])
+            accs |= 1 << r;
+    for (int r = 0; r < NUMREGS; ++r)
+        if (_acc[r] && _end[r] != r)
+        {
+            _why = "accumulator " + to_string(r) + " is written outside its guard";
+            return;
+        }
+    unsigned read = 0;
+    for (size_t e = NUMREGS; e < _expr.size(); ++e)
+        read |= _expr[e].uses;
+    for (auto & exit: _exits)
+        read |= _expr[exit.a].uses | _expr[exit.b].uses;
+    for (auto & guard: _guards)
+    {
+        read |= _expr[guard.a].uses | _expr[guard.b].uses;
+        for (auto & add: guard.adds)
+            read |= _expr[add.second].uses;
+    }
+    if (read & accs)
+    {
+        _why = "an accumulator is read";
+        return;
+    }
+
+    // Registers that come out of an iteration as an affine function of
+    // the registers it started with make up the map raised to powers;
+    // the rest must be recomputed from scratch each iteration.
+    unsigned rest = accs;
+    for (int r = 0; r < NUMREGS; ++r)
+        if (_expr[_end[r]].kind != AFFINE)
+            rest |= 1 << r;
+    _jump = true;
+    for (int r = 0; r < NUMREGS; ++r)
+        if (!_acc[r] && (_expr[_end[r]].uses & rest))
+            _jump = false;
+
+    for (int r = 0; r < NUMREGS; ++r)
+    {
+        const Expr & e = _expr[_end[r]];
+        if (_acc[r] || e.kind != AFFINE || e.c[NUMREGS])
+            _row[r] = OTHER;
+        else
+            for (int s = 0; s < NUMREGS; ++s)
+                if (e.c[s] != (s == r))
+                    _row[r] = OTHER;
+    }
+    for (int r = 0; r < NUMREGS; ++r)
+    {
+        const Expr & e = _expr[_end[r]];
+        if (_row[r] == INVARIANT || _acc[r] || e.kind != AFFINE)
+            continue;
+        bool onInvariants = true;
+        for (int s = 0; s < NUMREGS; ++s)
+            if (s != r && e.c[s] && _row[s] != INVARIANT)
+                onInvariants = false;
+        if (onInvariants && e.c[r] == 1)
+            _row[r] = COUNTER;
+        else if (onInvariants && e.c[r] % 2 == 0)
+            _row[r] = SETTLING;
+    }
+}
+
+void LoopSummary::evaluate(const value_t * reg, vector<value_t> & values) const
+{
+    values.resize(_expr.size());
+    for (size_t i = 0; i < _expr.size(); ++i)
+    {
+        const Expr & e = _expr[i];
+        if (e.kind == SUM)
+            values[i] = values[e.a] + values[e.b];
+        else if (e.kind == NOT_AND)
+            values[i] = ~(values[e.a] & values[e.b]);
+        else
+        {
+            value_t v = e.c[NUMREGS];
+            for (int r = 0; r < NUMREGS; ++r)
+                v += e.c[r] * reg[r];
+            values[i] = v;
+        }
+    }
+}
+
+// To the start of the next iteration, given `values` for this one;
+// accumulators are left to the caller
+void LoopSummary::step(value_t * reg, vector<value_t> & values) const
+{
+    for (int r = 0; r < NUMREGS; ++r)
+        if (!_acc[r])
+            reg[r] = values[_end[r]];
+}
+
+// `n` whole iterations of a loop without guards
+bool LoopSummary::advance(value_t * reg, long long n) const
+{
+    vector<value_t> values;
+    if (n <= SETTLE || !_jump)
+    {
+        if (n > MAX_TERMS)
+            return false;
+        for (long long i = 0; i < n; ++i)
+        {
+            evaluate(reg, values);
+            step(reg, values);
+        }
+        return true;
+    }
+
+    // The affine rows as a matrix over (reg, 1), raised to n - 1 by
+    // squaring; the last iteration is evaluated so that registers outside
+    // the map come out right too.
+    const int N = NUMREGS + 1;
+    typedef vector<value_t> Matrix;
+    auto multiply = [&](const Matrix & x, const Matrix & y)
+    {
+        Matrix z(N * N, 0);
+        for (int i = 0; i < N; ++i)
+            for (int k = 0; k < N; ++k)
+                if (x[i * N + k])
+                    for (int j = 0; j < N; ++j)
+                        z[i * N + j] += x[i * N + k] * y[k * N + j];
+        return z;
+    };
+    Matrix map(N * N, 0), power(N * N, 0);
+    for (int i = 0; i < N; ++i)
+        power[i * N + i] = 1;
+    for (int r = 0; r < NUMREGS; ++r)
+    {
+        const Expr & e = _expr[_end[r]];
+        if (e.kind == AFFINE)
+            copy(e.c, e.c + N, map.begin() + r * N);
+        else
+            map[r * N + r] = 1;
+    }
+    map[NUMREGS * N + NUMREGS] = 1;
+    for (unsigned long long k = n - 1; k; k >>= 1)
+    {
+        if (k & 1)
+            power = multiply(power, map);
+        map = multiply(map, map);
+    }
+    value_t start[NUMREGS];
+    copy(reg, reg + NUMREGS, start);
+    for (int r = 0; r < NUMREGS; ++r)
+    {
+        value_t v = power[r * N + NUMREGS];
+        for (int s = 0; s < NUMREGS; ++s)
+            v += power[r * N + s] * start[s];
+        reg[r] = v;
+    }
+    evaluate(reg, values);
+    step(reg, values);
+    return true;
+}
+
+// The first iteration, counting from the one starting with `reg`, in which
+// `exit` is taken; NEVER if it is not, UNKNOWN if that cannot be told.
+// The first iterations are evaluated one by one. Beyond them, only a test
+// of affine operands over invariants, counters and settled registers is
+// decided: its operands' difference then grows by the same amount each
+// iteration, and equality is a linear congruence mod 2^32.
+long long LoopSummary::solve(const Exit & exit, const value_t * reg) const
+{
+    value_t cur[NUMREGS];
+    copy(reg, reg + NUMREGS, cur);
+    vector<value_t> values;
+    value_t diff[2] = {0, 0};
+    for (int k = 0; k <= SETTLE + 1; ++k)
+    {
+        evaluate(cur, values);
+        if ((values[exit.a] == values[exit.b]) == exit.whenEqual)
+            return k;
+        if (k >= SETTLE)
+            diff[k - SETTLE] = values[exit.a] - values[exit.b];
+        step(cur, values);
+    }
+    const Expr & a = _expr[exit.a], & b = _expr[exit.b];
+    if (a.kind != AFFINE || b.kind != AFFINE)
+        return UNKNOWN;
+    for (int r = 0; r < NUMREGS; ++r)
+        if (a.c[r] != b.c[r] && _row[r] == OTHER)
+            return UNKNOWN;
+    // a difference that keeps changing is nonzero at SETTLE or after it
+    if (!exit.whenEqual)
+        return NEVER;
+
+    // step * j == -diff (mod 2^32), smallest j
+    const value_t step = diff[1] - diff[0], rhs = -diff[1];
+    if (!step)
+        return NEVER;
+    int shift = 0;
+    while (!(step >> shift & 1))
+        ++shift;
+    if (rhs & ((1u << shift) - 1))
+        return NEVER;
+    const value_t odd = step >> shift;
+    value_t inverse = odd;
+    for (int i = 0; i < 5; ++i)
+        inverse *= 2 - odd * inverse;
+    const unsigned long long period = 1ULL << (32 - shift);
+    const unsigned long long j = (unsigned long long)((rhs >> shift) * inverse) % period;
+    return SETTLE + 1 + (long long)j;
+}
+
+bool LoopSummary::apply(word_t * reg, int & pc, long long left, long long & count) const
+{
+    if (!ok())
+        return false;
+    value_t v[NUMREGS], start[NUMREGS];
+    for (int r = 0; r < NUMREGS; ++r)
+        v[r] = start[r] = reg[r];
+
+    // the exit taken first, the earlier beq within an iteration. An exit
+    // whose iteration is unknown has not been taken in the iterations
+    // evaluated, so it only rules out an answer past them.
+    const Exit * exit = NULL;
+    long long k = -1;
+    bool unknown = false;
+    for (auto & e: _exits)
+    {
+        const long long at = solve(e, v);
+        if (at == UNKNOWN)
+            unknown = true;
+        else if (at >= 0 && (!exit || at < k))
+        {
+            exit = &e;
+            k = at;
+        }
+    }
+    if (!exit || (unknown && k > SETTLE + 1))
+        return false;
+
+    vector<value_t> values;
+    long long n = 0;
+    if (!_guards.empty())
+    {
+        // every iteration's guards decide which terms the accumulators add
+        if (k > MAX_TERMS)
+            return false;
+        value_t sum[NUMREGS] = {0};
+        for (long long i = 0; ; ++i)
+        {
+            evaluate(v, values);
+            for (auto & g: _guards)
+            {
+                if (i == k && g.pc > exit->pc)
+                    break;
+                if (values[g.a] == values[g.b])
+                    continue;
+                n += g.length;
+                for (auto & add: g.adds)
+                    sum[add.first] += values[add.second];
+            }
+            if (i == k)
+                break;
+            n += _spine;
+            step(v, values);
+        }
+        n += exit->spine;
+        if (left >= 0 && n > left)
+            return false;
+        for (int r = 0; r < NUMREGS; ++r)
+            reg[r] = _acc[r] ? start[r] + sum[r] : values[exit->state[r]];
+    }
+    else
+    {
+        n = k * _spine + exit->spine;
+        if (left >= 0 && n > left)
+        {
+            // as many whole iterations as fit
+            const long long whole = left / _spine;
+            if (!whole || !advance(v, whole))
+                return false;
+            for (int r = 0; r < NUMREGS; ++r)
+                reg[r] = v[r];
+            pc = _head;
+            count = whole * _spine;
+            return true;
+        }
+        if (!advance(v, k))
+            return false;
+        evaluate(v, values);
+        for (int r = 0; r < NUMREGS; ++r)
+            reg[r] = values[exit->state[r]];
+    }
+    pc = exit->target;
+    count = n;
+    return true;
+}
+
+// The loaded program image, as the analysis sees it
+static vector<word_t> image(const Simulator & machine)
+{
+    vector<word_t> words(machine.memSize());
+    for (int pc = 0; pc < machine.memSize(); ++pc)
+        words[pc] = machine.peek(pc);
+    return words;
+}
+
+LoopSkipper::LoopSkipper(Simulator & machine, bool verify):
+    _machine(machine), _analysis(image(machine).data(), machine.memSize()),
+    _at(machine.memSize(), -1), _verify(verify), _count(0), _skips(0), _skipped(0)
+{
+    for (auto & loop: _analysis.loops())
+    {
+        _summaries.push_back(LoopSummary(_analysis, loop));
+        if (_summaries.back().ok())
+            _at[loop.head] = _summaries.size() - 1;
+    }
+}
+
+// A store may have rewritten the loop since it was analysed
+bool LoopSkipper::intact(const LoopSummary & summary) const
+{
+    for (int pc = summary.head(); pc <= summary.latch(); ++pc)
+        if (_machine.peek(pc) != _analysis.word(pc))
+            return false;
+    return true;
+}
+
+// Executes the `count` instructions the summary skipped and compares
+void LoopSkipper::check(const LoopSummary & summary, const word_t * reg, int pc, long long count)
+{
+    for (long long i = 0; i < count; ++i)
+        _machine.next();
+    bool same = _machine.pc() == pc;
+    for (int r = 0; r < 8; ++r)
+        same = same && _machine.reg(r) == reg[r];
+    if (same)
+        return;
+    string error = "Loop summary at " + to_string(summary.head()) + " disagrees with execution after "
+                 + to_string(count) + " instructions: pc " + to_string(pc) + ", registers";
+    for (int r = 0; r < 8; ++r)
+        error += " " + to_string(reg[r]);
+    error += "; executed: pc " + to_string(_machine.pc()) + ", registers";
+    for (int r = 0; r < 8; ++r)
+        error += " " + to_string(_machine.reg(r));
+    throw runtime_error(error);
+}
+
+long long LoopSkipper::run(long long budget)
+{
+    _count = 0;
+    while (budget < 0 || _count < budget)
+    {
+        const int pc = _machine.pc();
+        const int at = (unsigned)pc < _at.size() && !_machine.halted() ? _at[pc] : -1;
+        if (at < 0 || !intact(_summaries[at]))
+        {
+            if (!_machine.next())
+                break;
+            ++_count;
+            continue;
+        }
+
+        const LoopSummary & summary = _summaries[at];
+        word_t reg[8];
+        for (int r = 0; r < 8; ++r)
+            reg[r] = _machine.reg(r);
+        int exit;
+        long long n;
+        if (summary.apply(reg, exit, budget < 0 ? -1 : budget - _count, n))
+        {
+            if (_verify)
+                check(summary, reg, exit, n);
+            else
+            {
+                for (int r = 0; r < 8; ++r)
+                    _machine.setReg(r, reg[r]);
+                _machine.setPC(exit);
+            }
+            _count += n;
+            ++_skips;
+            _skipped += n;
+            continue;
+        }
+        // no closed form from here: execute until the loop is left
+        do
+        {
+            if (!_machine.next())
+                return _count;
+            ++_count;
+        }
+        while ((budget < 0 || _count < budget)
+               && _machine.pc() >= summary.head() && _machine.pc() <= summary.latch());
+    }
+    return _count;
+}
+
+void LoopSkipper::printStats(long long count, ostream & os) const
+{
+    int summarized = 0;
+    for (auto & summary: _summaries)
+        summarized += summary.ok();
+    char line[200];
+    snprintf(line, sizeof(line), "loops: %zu found, %d summarized; %lld entries skipped, %lld of %lld instructions (%.1f%%)%s\n",
+             _summaries.size(), summarized, _skips, _skipped, count,
+             count ? 100.0 * _skipped / count : 0.0, _verify ? ", each verified by execution" : "");
+    os << line;
+}
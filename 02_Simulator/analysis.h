@@ -0,0 +1,191 @@
+// Static analysis of a machine-code image before it runs. Analysis builds
+// the control-flow graph from beq and jalr, finds the code no path reaches
+// and the natural loops. jalr targets are not known statically. A jalr
+// through a register loaded by `lw 0 r addr` earlier in the same
+// straight-line run (the `.fill label` idiom) is a call: the callee is the
+// word at addr and becomes a root of its own, and the call falls through
+// to the next word as if it had returned. Any other jalr is a return and
+// ends its path, so loops never span calls.
+//
+// LoopSummary gives a register-only loop a closed form. A loop qualifies
+// when its body is one contiguous range ending in the branch back to the
+// head, holds only add, nand, noop and beq, and its other branches either
+// leave the loop or skip forward over adds into accumulators ("guards").
+// One iteration is then a map over the registers: each register's value at
+// the end of an iteration is an expression in the values at its start,
+// affine wherever only add is involved. The exit iteration is solved from
+// the exit branches (a linear congruence for counters, direct evaluation
+// for the first iterations of registers that double until they vanish),
+// the registers are advanced there by powers of the affine map, and each
+// accumulator adds up one term per iteration its guard lets through, so
+// loops with guards are only summarized up to MAX_TERMS iterations.
+//
+// LoopSkipper runs a program on the reference interpreter and replaces
+// every entry into a summarized loop by its summary. With verification on
+// it executes the loop all the same and compares the outcome with the
+// summary's, so a wrong summary stops the run instead of going unnoticed.
+#ifndef LC2K_ANALYSIS_H
+#define LC2K_ANALYSIS_H
+
+#include "simulator.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+class Analysis
+{
+ public:
+    typedef Simulator::word_t word_t;
+
+    // A maximal straight-line run [begin, end) of reachable words
+    struct Block
+    {
+        int begin, end;
+        std::vector<int> succ;      // block indices
+        bool leaves;                // also continues outside the image
+        bool indirect;              // ends in jalr, a call or a return
+    };
+    struct Loop
+    {
+        int head, latch;            // latch: last word branching back to head
+        std::vector<int> blocks;    // in address order, head first
+        int size;                   // words in those blocks
+        bool pure;                  // only add, nand, beq and noop
+    };
+
+    Analysis(const word_t * words, int count);
+
+    int size() const { return (int)_words.size(); }
+    word_t word(int pc) const { return _words[pc]; }
+    bool reachable(int pc) const { return _block_at[pc] >= 0; }
+    int blockAt(int pc) const { return _block_at[pc]; }
+    const std::vector<Block> & blocks() const { return _blocks; }
+    // Immediate dominator of a block; the entry block and callees are
+    // their own
+    int idom(int block) const { return _idom[block]; }
+    // Callee addresses, ascending
+    const std::vector<int> & indirectTargets() const { return _indirect; }
+    const std::vector<Loop> & loops() const { return _loops; }
+
+ private:
+    std::vector<word_t> _words;
+    std::vector<int> _block_at;     // -1 for unreachable words
+    std::vector<Block> _blocks;
+    std::vector<int> _idom;
+    std::vector<int> _indirect;
+    std::vector<Loop> _loops;
+
+    void findReachable(std::vector<char> & reached, std::vector<char> & leader);
+    void findDominators();
+    void findLoops();
+};
+
+class LoopSummary
+{
+ public:
+    typedef Simulator::word_t word_t;
+
+    LoopSummary(const Analysis & analysis, const Analysis::Loop & loop);
+
+    bool ok() const { return _why.empty(); }
+    // Why the loop has no summary, empty when it has one
+    const std::string & reason() const { return _why; }
+    int head() const { return _head; }
+    int latch() const { return _latch; }
+
+    // From registers `reg` at the head, spending at most `left`
+    // instructions (no limit when negative): on success `reg` and `pc`
+    // hold the state where the loop leaves, or after as many whole
+    // iterations as `left` allows, and `count` the instructions executed.
+    // Fails when the loop never ends, or ends too late to be solved.
+    bool apply(word_t * reg, int & pc, long long left, long long & count) const;
+
+ private:
+    typedef unsigned int value_t;
+    static const int NUMREGS = 8;
+    static const int SETTLE = 32;   // doubling has cleared any register by then
+    static const long long MAX_TERMS = 4096;
+    static const long long NEVER = -1, UNKNOWN = -2;   // from solve()
+
+    // Expressions over the registers at the start of an iteration. An
+    // AFFINE node is c[0..7] . reg + c[8]; its children come earlier in
+    // _expr, so evaluating in order sees every operand first.
+    enum Kind { AFFINE, SUM, NOT_AND };
+    struct Expr
+    {
+        Kind kind;
+        int a, b;
+        value_t c[NUMREGS + 1];
+        unsigned char uses;         // registers whose start values it reads
+    };
+    struct Exit
+    {
+        int pc;                     // the beq
+        int target;
+        int a, b;                   // operand expressions
+        bool whenEqual;             // false for a conditional latch
+        int spine;                  // spine instructions up to and including it
+        int state[NUMREGS];         // register expressions at the beq
+    };
+    struct Guard
+    {
+        int pc;
+        int a, b;                   // skips when they are equal
+        int length;                 // instructions skipped
+        std::vector<std::pair<int, int> > adds;  // accumulator, addend expression
+    };
+    enum Row { INVARIANT, COUNTER, SETTLING, OTHER };
+
+    int _head, _latch;
+    std::string _why;
+    std::vector<Expr> _expr;
+    int _end[NUMREGS];              // register expressions after one iteration
+    Row _row[NUMREGS];
+    bool _acc[NUMREGS];
+    int _spine;                     // instructions per iteration outside guards
+    bool _jump;                     // the affine rows can be raised to a power
+    std::vector<Exit> _exits;
+    std::vector<Guard> _guards;
+
+    int affine(int reg);
+    int combine(Kind kind, int a, int b);
+    void build(const Analysis & analysis);
+    void evaluate(const value_t * reg, std::vector<value_t> & values) const;
+    void step(value_t * reg, std::vector<value_t> & values) const;
+    bool advance(value_t * reg, long long n) const;
+    long long solve(const Exit & exit, const value_t * reg) const;
+};
+
+class LoopSkipper
+{
+ public:
+    // `machine` holds a freshly loaded program; it is analysed as loaded.
+    LoopSkipper(Simulator & machine, bool verify = false);
+
+    const Analysis & analysis() const { return _analysis; }
+    const std::vector<LoopSummary> & summaries() const { return _summaries; }
+    // Run until halt or `budget` instructions (no limit when negative) on
+    // the reference interpreter, skipping summarized loops. Returns the
+    // number of instructions executed, skipped ones included.
+    long long run(long long budget = -1);
+    // The count of the last run(), also when it threw
+    long long count() const { return _count; }
+    void printStats(long long count, std::ostream & os = std::cout) const;
+
+ private:
+    typedef Simulator::word_t word_t;
+
+    Simulator & _machine;
+    Analysis _analysis;
+    std::vector<LoopSummary> _summaries;
+    std::vector<int> _at;           // summary index by head pc, -1 if none
+    bool _verify;
+    long long _count;
+    long long _skips, _skipped;
+
+    bool intact(const LoopSummary & summary) const;
+    void check(const LoopSummary & summary, const word_t * reg, int pc, long long count);
+};
+
+#endif
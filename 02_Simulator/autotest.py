@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+# Checks that every execution engine, the pipeline model with every
+# predictor, a run through the cache model, a single-hart multi-hart run and
+# runs with loops skipped (checked against execution or not) reach the same
+# final state as the reference tracing run, and that a delta trace expands
+# back into that run. parallel_sum then checks that four
+# harts partition its work and that every engine follows the same schedule,
+# and combination that lockstep lanes over different n and r each end the
+# way a separate run on the patched program does. A generated program of
+# store-heavy blocks fills the JIT's code buffer.
+import subprocess
+import os.path
+import sys
+import tempfile
+
+testCases = [
+        'basic_test.asm.mc',
+        'basic_test2.asm.mc',
+        'combination.asm.mc',
+        'combination_optimized.asm.mc',
+        'factorial.asm.mc',
+        'factorial_iterative.asm.mc',
+        'factorial_tail_call.asm.mc',
+        'fib.asm.mc',
+        'fib_tail_call.asm.mc',
+        'loop_bit_exit.asm.mc',
+        'loop_nand_exit.asm.mc',
+        'multiplication.asm.mc',
+        'negative_offset.asm.mc',
+        ]
+
+engines = ['switch', 'threaded', 'superblock', 'jit']
+
+predictors = ['nottaken', 'backward', 'bimodal']
+
+# (quantum, seed) pairs for the multi-hart runs; seed 0 is fixed slices
+schedules = [('1', '0'), ('3', '0'), ('1000', '0'), ('5', '1'), ('50', '42')]
+
+class WrongOutput(Exception):
+    def __init__(self, engine, lineno, exp, rel):
+        self.engine = engine
+        self.lineno = lineno
+        self.exp = exp
+        self.rel = rel
+
+    def __str__(self):
+        return ('Engine %s, line %d:\nExpectancy: %s\nReality:    %s'
+                % (self.engine, self.lineno, self.exp.strip(), self.rel.strip()))
+
+def finalState(output):
+    # everything from the halt summary on
+    lines = output.splitlines(True)
+    for i, line in enumerate(lines):
+        if line.startswith('machine halted'):
+            return lines[i:]
+    return lines
+
+def run(args):
+    result = subprocess.run([simulator] + args, stdout = subprocess.PIPE,
+            stderr = subprocess.DEVNULL, universal_newlines = True)
+    if result.returncode:
+        raise WrongOutput(' '.join(args), -1, '', 'The program signals an error.')
+    return result.stdout
+
+def compare(engine, reference, lines):
+    if len(lines) != len(reference):
+        raise WrongOutput(engine, -1,
+                str(len(reference)) + ' lines', str(len(lines)) + ' lines')
+    for lineno, (l1, l2) in enumerate(zip(reference, lines)):
+        if l1 != l2:
+            raise WrongOutput(engine, lineno, l1, l2)
+
+def testTrace(infile, reference):
+    with tempfile.TemporaryDirectory() as tmp:
+        trace = os.path.join(tmp, 'trace.lcdt')
+        run(['-t', trace, infile])
+        compare('delta trace', reference, run(['-x', trace]).splitlines(True))
+
+def testFaultTrace(infile):
+    # a run that faults keeps its trace, and the error it ends with
+    def both(args):
+        result = subprocess.run([simulator] + args, stdout = subprocess.PIPE,
+                stderr = subprocess.PIPE, universal_newlines = True)
+        if not result.returncode:
+            raise WrongOutput(' '.join(args), -1, 'an error', 'exit status 0')
+        return result.stdout.splitlines(True) + [result.stderr]
+    with tempfile.TemporaryDirectory() as tmp:
+        trace = os.path.join(tmp, 'trace.lcdt')
+        reference = both([infile])
+        both(['-t', trace, infile])
+        compare('faulting delta trace', reference, both(['-x', trace]))
+
+def testJitBuffer():
+    # 412 blocks of 62 sw and a jump, each encoding to about 10 KB of
+    # native code, overfill the JIT buffer once a dozen passes make them hot
+    def encode(opcode, a, b, field):
+        return opcode << 22 | a << 19 | b << 16 | field & 0xffff
+    sw = encode(3, 0, 3, 32767)
+    image = [encode(2, 0, 1, 26414), encode(2, 0, 2, 26415)]
+    for chunk in range(412):
+        image += [sw] * 62 + [encode(4, 0, 0, 1), encode(7, 0, 0, 0)]
+    image += [sw] * 40
+    image += [encode(0, 1, 2, 1), encode(4, 1, 0, 1)]
+    image += [encode(4, 0, 0, 2 - (len(image) + 1)), encode(6, 0, 0, 0), 12, -1]
+    with tempfile.TemporaryDirectory() as tmp:
+        infile = os.path.join(tmp, 'stores.mc')
+        with open(infile, 'w') as f:
+            f.write('\n'.join(str(word) for word in image) + '\n')
+        reference = run(['-q', infile]).splitlines(True)
+        for engine in engines[1:]:
+            compare('stores ' + engine, reference,
+                    run(['-q', '-e', engine, infile]).splitlines(True))
+
+def testEngines(infile):
+    full = run([infile]).splitlines(True)
+    testTrace(infile, full)
+    reference = finalState(''.join(full))
+    for engine in engines:
+        compare(engine, reference, run(['-q', '-e', engine, infile]).splitlines(True))
+    # the pipeline statistics follow the final state
+    for predictor in predictors:
+        lines = run(['-p', predictor, infile]).splitlines(True)
+        compare('pipeline ' + predictor, reference, lines[:len(reference)])
+    # so do the cache statistics
+    lines = run(['-c', 'default', infile]).splitlines(True)
+    compare('cache', reference, lines[:len(reference)])
+    # hart 0 gets id 0 in reg 1, which is where a plain run starts too
+    lines = run(['-H', '1', '-Q', '7', infile]).splitlines(True)
+    compare('one hart', reference, lines[:len(reference)])
+    for mode in [['-l'], ['-l', '--verify']]:
+        lines = run(mode + [infile]).splitlines(True)
+        compare(' '.join(mode), reference, lines[:len(reference)])
+
+def testHarts(infile):
+    sums = ['28', '32', '36', '40']
+    for quantum, seed in schedules:
+        args = ['-H', '4', '-Q', quantum, '-r', seed, infile]
+        reference = run(args)
+        lines = reference.splitlines()
+        found = [l.split()[-1] for l in lines if l.strip().startswith('mem[ ')][-4:]
+        if found != sums:
+            raise WrongOutput(' '.join(args), -1, ' '.join(sums), ' '.join(found))
+        for engine in engines:
+            compare('harts ' + engine, reference.splitlines(True),
+                    run(['-e', engine] + args).splitlines(True))
+
+def testLanes(infile):
+    # n and r of combination live at 44 and 45
+    lanes = [(n, r) for n in range(9) for r in range(n + 1)]
+    with open(infile) as f:
+        image = f.read().splitlines()
+    with tempfile.TemporaryDirectory() as tmp:
+        lanesFile = os.path.join(tmp, 'lanes.txt')
+        with open(lanesFile, 'w') as f:
+            f.write('# n r\n')
+            for n, r in lanes:
+                f.write('44=%d 45=%d\n' % (n, r))
+        reference = []
+        for lane, (n, r) in enumerate(lanes):
+            patched = os.path.join(tmp, 'patched.mc')
+            with open(patched, 'w') as f:
+                f.write('\n'.join(image[:44] + [str(n), str(r)] + image[46:]) + '\n')
+            reference += ['lane %d\n' % lane] + run(['-q', patched]).splitlines(True)
+        for mode in [[], ['--scalar']]:
+            lines = run(['-L', lanesFile] + mode + [infile]).splitlines(True)
+            compare('lockstep ' + ' '.join(mode), reference, lines[:-1])
+
+def main():
+    if len(sys.argv) < 3:
+        print('Usage: python3 autotest.py [simulator] [path to test data]')
+        return
+
+    global simulator
+    simulator = sys.argv[1]
+    testDataPath = sys.argv[2]
+
+    print('LC2K Simulator Tests')
+    failureCount = 0
+
+    for infile in testCases:
+        try:
+            testEngines(os.path.join(testDataPath, infile))
+        except WrongOutput as e:
+            print('---\nTest Case: %s ... Fail!' % infile)
+            print(e)
+            failureCount += 1
+        else:
+            print('---\nTest Case: %s ... Pass!' % infile)
+
+    special = [(testHarts, 'parallel_sum.asm.mc'), (testLanes, 'combination.asm.mc'),
+               (testFaultTrace, 'bad_jump.asm.mc'), (testJitBuffer, None)]
+    for test, infile in special:
+        try:
+            if infile:
+                test(os.path.join(testDataPath, infile))
+            else:
+                test()
+        except WrongOutput as e:
+            print('---\nTest Case: %s (%s) ... Fail!' % (infile or 'generated', test.__name__))
+            print(e)
+            failureCount += 1
+        else:
+            print('---\nTest Case: %s (%s) ... Pass!' % (infile or 'generated', test.__name__))
+
+    total = len(testCases) + len(special)
+    print('---\nTesting finish!')
+    print('Success:', total - failureCount)
+    print('Failure:', failureCount)
+    print('Total:', total)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,129 @@
+#include "cache.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sstream>
+
+using namespace std;
+
+static bool powerOfTwo(long long n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+string Cache::check(const Config & config)
+{
+    if (!powerOfTwo(config.block))
+        return "block size must be a power of two";
+    if (config.ways < 1)
+        return "associativity must be positive";
+    // comparing by division keeps block * ways from overflowing
+    if (config.words < config.block || config.ways > config.words / config.block
+            || config.words % (config.block * config.ways))
+        return "size must be a multiple of block size times associativity";
+    if (!powerOfTwo(config.words / (config.block * config.ways)))
+        return "the number of sets must be a power of two";
+    return "";
+}
+
+Cache::Cache(const Config & config): _config(config), _stats(), _blockBits(0), _clock(0)
+{
+    while ((1 << _blockBits) < config.block)
+        ++_blockBits;
+    int sets = config.words / (config.block * config.ways);
+    _setMask = sets - 1;
+    _tag.assign(sets * config.ways, 0);
+    _used.assign(sets * config.ways, 0);
+    _dirty.assign(sets * config.ways, 0);
+    _mru.assign(sets, 0);
+}
+
+bool CacheModel::parse(const string & text, Cache::Config & config,
+                       Timing & timing, bool & unified, string & error)
+{
+    Cache::Config c = {1024, 4, 2, true};
+    Timing t = {1, 20};
+    bool u = false;
+    stringstream ss(text);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        if (item == "default")
+            continue;
+        if (item == "unified")
+        {
+            u = true;
+            continue;
+        }
+        size_t eq = item.find('=');
+        string key = item.substr(0, eq), value = eq == string::npos ? "" : item.substr(eq + 1);
+        char * end;
+        long n = strtol(value.c_str(), &end, 10);
+        bool number = !value.empty() && *end == '\0' && n >= 0 && n <= (1 << 24);
+        if (key == "write" && (value == "back" || value == "through"))
+            c.writeBack = value == "back";
+        else if (key == "size" && number)
+            c.words = n;
+        else if (key == "block" && number)
+            c.block = n;
+        else if (key == "ways" && number)
+            c.ways = n;
+        else if (key == "hit" && number)
+            t.hit = n;
+        else if (key == "memory" && number)
+            t.memory = n;
+        else
+        {
+            error = "Invalid cache setting: " + item;
+            return false;
+        }
+    }
+    error = Cache::check(c);
+    if (!error.empty())
+    {
+        error = "Invalid cache: " + error;
+        return false;
+    }
+    config = c;
+    timing = t;
+    unified = u;
+    return true;
+}
+
+CacheModel::CacheModel(const Cache::Config & config, const Timing & timing, bool unified):
+    _first(config), _second(config), _icache(_first), _dcache(unified ? _first : _second),
+    _timing(timing), _cycles(0)
+{
+}
+
+static void printCache(ostream & os, const char * name, const Cache & cache)
+{
+    const Cache::Stats & s = cache.stats();
+    long long accesses = s.reads + s.writes, misses = s.readMisses + s.writeMisses;
+    char line[160];
+    snprintf(line, sizeof(line), "\t%s: %lld accesses, %lld misses, hit rate %.2f%%\n", name,
+             accesses, misses, accesses ? 100.0 * (accesses - misses) / accesses : 0.0);
+    os << line;
+    snprintf(line, sizeof(line), "\t\treads %lld (%lld misses), writes %lld (%lld misses), writebacks %lld\n",
+             s.reads, s.readMisses, s.writes, s.writeMisses, s.writebacks);
+    os << line;
+}
+
+void CacheModel::printStats(ostream & os) const
+{
+    const Cache::Config & c = _first.config();
+    char line[160];
+    snprintf(line, sizeof(line), "cache (%s, %d words, %d-word blocks, %d-way, write-%s): %lld memory cycles\n",
+             &_icache == &_dcache ? "unified" : "split", c.words, c.block, c.ways,
+             c.writeBack ? "back" : "through", _cycles);
+    os << line;
+    if (&_icache == &_dcache)
+        printCache(os, "unified", _first);
+    else
+    {
+        printCache(os, "instruction", _icache);
+        printCache(os, "data", _dcache);
+    }
+}
@@ -0,0 +1,197 @@
+// Cache model in front of simulator memory. A Cache is one set-associative
+// LRU cache; CacheModel puts an instruction and a data cache (or one
+// unified cache) behind Simulator::runObserved(), so every fetch, lw and sw
+// goes through it, and totals the memory cycles they cost.
+//
+// Lookups touch one set: tags and LRU stamps of a set are adjacent, the
+// number of sets is a power of two and the last hit way is tried first.
+#ifndef LC2K_CACHE_H
+#define LC2K_CACHE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+class Cache
+{
+ public:
+    struct Config
+    {
+        int words;          // capacity
+        int block;          // words per block, a power of two
+        int ways;           // associativity; words / (block * ways) sets, a power of two
+        bool writeBack;     // write-back with write-allocate, otherwise
+                            // write-through without write-allocate
+    };
+
+    struct Stats
+    {
+        long long reads, readMisses;
+        long long writes, writeMisses;
+        long long writebacks;       // dirty blocks written to memory
+    };
+
+    // Empty string when `config` is usable, otherwise what is wrong with it
+    static std::string check(const Config & config);
+    explicit Cache(const Config & config);
+
+    const Config & config() const { return _config; }
+    const Stats & stats() const { return _stats; }
+
+    // Return true on a hit. A miss fills the block, except for a write in
+    // write-through mode; *evictedDirty tells whether that pushed a dirty
+    // block out.
+    inline bool read(int addr, bool * evictedDirty);
+    inline bool write(int addr, bool * evictedDirty);
+
+ private:
+    Config _config;
+    Stats _stats;
+    int _blockBits;
+    unsigned _setMask;
+    // per line, set after set: block number + 1 (0 for an empty line),
+    // last use and dirty flag
+    std::vector<unsigned> _tag;
+    std::vector<unsigned long long> _used;
+    std::vector<unsigned char> _dirty;
+    std::vector<unsigned char> _mru;            // last hit way per set
+    unsigned long long _clock;
+
+    inline int find(unsigned set, unsigned tag);
+    inline int fill(unsigned set, unsigned tag, bool * evictedDirty);
+};
+
+int Cache::find(unsigned set, unsigned tag)
+{
+    unsigned base = set * _config.ways;
+    int mru = _mru[set];
+    if (_tag[base + mru] == tag)
+        return mru;
+    for (int way = 0; way < _config.ways; ++way)
+        if (_tag[base + way] == tag)
+        {
+            _mru[set] = way;
+            return way;
+        }
+    return -1;
+}
+
+// Replaces the least recently used line of the set, empty lines first
+int Cache::fill(unsigned set, unsigned tag, bool * evictedDirty)
+{
+    unsigned base = set * _config.ways;
+    int victim = 0;
+    for (int way = 0; way < _config.ways; ++way)
+    {
+        if (!_tag[base + way])
+        {
+            victim = way;
+            break;
+        }
+        if (_used[base + way] < _used[base + victim])
+            victim = way;
+    }
+    *evictedDirty = _tag[base + victim] && _dirty[base + victim];
+    _stats.writebacks += *evictedDirty;
+    _tag[base + victim] = tag;
+    _dirty[base + victim] = 0;
+    _mru[set] = victim;
+    return victim;
+}
+
+bool Cache::read(int addr, bool * evictedDirty)
+{
+    unsigned tag = ((unsigned)addr >> _blockBits) + 1;
+    unsigned set = (tag - 1) & _setMask;
+    ++_stats.reads;
+    *evictedDirty = false;
+    int way = find(set, tag);
+    bool hit = way >= 0;
+    if (!hit)
+    {
+        ++_stats.readMisses;
+        way = fill(set, tag, evictedDirty);
+    }
+    _used[set * _config.ways + way] = ++_clock;
+    return hit;
+}
+
+bool Cache::write(int addr, bool * evictedDirty)
+{
+    unsigned tag = ((unsigned)addr >> _blockBits) + 1;
+    unsigned set = (tag - 1) & _setMask;
+    ++_stats.writes;
+    *evictedDirty = false;
+    int way = find(set, tag);
+    bool hit = way >= 0;
+    if (!hit)
+    {
+        ++_stats.writeMisses;
+        if (!_config.writeBack)
+            return false;
+        way = fill(set, tag, evictedDirty);
+    }
+    _used[set * _config.ways + way] = ++_clock;
+    if (_config.writeBack)
+        _dirty[set * _config.ways + way] = 1;
+    return hit;
+}
+
+// Observer for Simulator::runObserved(). Every access costs `hit` cycles;
+// moving a block between memory and a cache costs `memory` cycles for the
+// first word and one for each further word, and a write-through store
+// costs `memory` cycles.
+class CacheModel
+{
+ public:
+    struct Timing
+    {
+        int hit;
+        int memory;
+    };
+
+    // Parses comma-separated settings, e.g. "size=256,block=4,ways=2,write=back":
+    // size, block, ways, write (back or through), hit, memory, and
+    // "unified" for one cache shared by fetches and data. Missing
+    // settings keep their defaults (1024 words, 4-word blocks, 2 ways,
+    // write-back, hit 1, memory 20). "default" alone is accepted.
+    // Returns false with a message in `error` when the text is not valid.
+    static bool parse(const std::string & text, Cache::Config & config,
+                      Timing & timing, bool & unified, std::string & error);
+
+    CacheModel(const Cache::Config & config, const Timing & timing, bool unified);
+    CacheModel(const CacheModel &) = delete;
+    CacheModel & operator=(const CacheModel &) = delete;
+
+    void retire(int pc, int) { access(_icache, pc, false); }
+    void read(int addr) { access(_dcache, addr, false); }
+    void write(int addr) { access(_dcache, addr, true); }
+    void branch(int, bool) {}
+    void jump(int, int) {}
+
+    long long cycles() const { return _cycles; }
+    void printStats(std::ostream & os = std::cout) const;
+
+ private:
+    Cache _first, _second;
+    Cache & _icache;
+    Cache & _dcache;
+    Timing _timing;
+    long long _cycles;
+
+    inline void access(Cache & cache, int addr, bool isWrite)
+    {
+        bool evictedDirty;
+        bool hit = isWrite ? cache.write(addr, &evictedDirty) : cache.read(addr, &evictedDirty);
+        const int block = cache.config().block;
+        _cycles += _timing.hit;
+        if (evictedDirty)
+            _cycles += _timing.memory + block - 1;
+        if (isWrite && !cache.config().writeBack)
+            _cycles += _timing.memory;
+        else if (!hit)
+            _cycles += _timing.memory + block - 1;
+    }
+};
+
+#endif
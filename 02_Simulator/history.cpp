@@ -0,0 +1,222 @@
+#include "history.h"
+
+#include <vector>
+#include <set>
+#include <stdexcept>
+
+using namespace std;
+
+typedef Simulator::word_t word_t;
+typedef Simulator::Decoded Decoded;
+
+enum { ADD, NAND, LW, SW, BEQ, JALR, HALT, NOOP };
+
+History::History(Simulator & machine):
+    _machine(machine), _pc0(machine.pc()), _count(0), _base(0)
+{
+    for (int i = 0; i < machine.memSize(); ++i)
+        _image.push_back(machine.peek(i));
+    for (int r = 0; r < 8; ++r)
+        _reg0[r] = machine.reg(r);
+}
+
+void History::put32(int v)
+{
+    for (int i = 0; i < 4; ++i)
+        _log.push_back((unsigned char)(v >> 8 * i));
+}
+
+int History::get32(size_t at) const
+{
+    return (int)(_log[at] | _log[at + 1] << 8 | _log[at + 2] << 16 | (unsigned)_log[at + 3] << 24);
+}
+
+// Logs, in this order, the old pc, the old register and the old memory
+// word that the step overwrote, then the tag. `wrote` gets the address of
+// a memory word written, -1 for none.
+bool History::record(int & wrote)
+{
+    const int pc = _machine.pc();
+    int reg = -1;
+    wrote = -1;
+    if ((unsigned)pc < (unsigned)Simulator::MEMORY_WORDS && !_machine.halted())
+    {
+        Decoded ins = Simulator::decode(_machine.peek(pc));
+        switch (ins.opcode)
+        {
+            case ADD: case NAND: reg = ins.destReg; break;
+            case LW: case JALR: reg = ins.regB; break;
+            case SW: wrote = _machine.reg(ins.regA) + ins.offset; break;
+        }
+    }
+    const word_t oldReg = reg >= 0 ? _machine.reg(reg) : 0;
+    const word_t oldMem = (unsigned)wrote < (unsigned)Simulator::MEMORY_WORDS ? _machine.peek(wrote) : 0;
+    if (!_machine.next())
+    {
+        wrote = -1;
+        return false;
+    }
+
+    // halt leaves pc where it is
+    int tag = reg >= 0 ? LOG_REG : 0;
+    if (wrote >= 0)
+        tag |= LOG_MEM;
+    if (_machine.halted())
+        tag |= LOG_HALT;
+    else if (_machine.pc() != pc + 1)
+        tag |= LOG_JUMP;
+    if (tag & LOG_JUMP)
+        put32(pc);
+    if (tag & LOG_REG)
+    {
+        _log.push_back((unsigned char)reg);
+        put32(oldReg);
+    }
+    if (tag & LOG_MEM)
+    {
+        _log.push_back((unsigned char)wrote);
+        _log.push_back((unsigned char)(wrote >> 8));
+        put32(oldMem);
+    }
+    _log.push_back((unsigned char)tag);
+    ++_count;
+    return true;
+}
+
+bool History::undo(int & wrote)
+{
+    wrote = -1;
+    if (_count == _base)
+        return false;
+    size_t at = _log.size() - 1;
+    const int tag = _log[at];
+    if (tag & LOG_MEM)
+    {
+        at -= 6;
+        wrote = _log[at] | _log[at + 1] << 8;
+        _machine.poke(wrote, get32(at + 2));
+    }
+    if (tag & LOG_REG)
+    {
+        at -= 5;
+        _machine.setReg(_log[at], get32(at + 1));
+    }
+    if (tag & LOG_JUMP)
+    {
+        at -= 4;
+        _machine.setPC(get32(at));
+    }
+    else if (tag & LOG_HALT)
+        _machine.resume();
+    else
+        _machine.setPC(_machine.pc() - 1);
+    _log.resize(at);
+    --_count;
+    return true;
+}
+
+bool History::step()
+{
+    int wrote;
+    return record(wrote);
+}
+
+bool History::back()
+{
+    int wrote;
+    return undo(wrote);
+}
+
+void History::restart()
+{
+    _machine.reset();
+    _machine.setMC(_image.data(), _image.size());
+    _machine.setPC(_pc0);
+    for (int r = 0; r < 8; ++r)
+        _machine.setReg(r, _reg0[r]);
+    _count = _base = 0;
+    _log.clear();
+}
+
+long long History::fastForward(long long n)
+{
+    const long long start = _count;
+    try
+    {
+        _count += _machine.run(n);
+    }
+    catch (runtime_error &)
+    {
+        _count = start + _machine.retired();
+        _base = _count;
+        _log.clear();
+        throw;
+    }
+    _base = _count;
+    _log.clear();
+    return _count - start;
+}
+
+void History::seek(long long target)
+{
+    if (target < _base)
+    {
+        restart();
+        fastForward(target);
+        return;
+    }
+    while (_count > target && back())
+        ;
+    while (_count < target && step())
+        ;
+}
+
+History::Stop History::proceed(long long limit, int & where)
+{
+    for (long long n = 0; limit < 0 || n < limit; ++n)
+    {
+        int wrote;
+        if (!record(wrote))
+        {
+            where = _machine.pc();
+            return STOP_HALT;
+        }
+        if (wrote >= 0 && watches.count(wrote))
+        {
+            where = wrote;
+            return STOP_WATCH;
+        }
+        if (_machine.halted())
+        {
+            where = _machine.pc();
+            return STOP_HALT;
+        }
+        if (breakpoints.count(_machine.pc()))
+        {
+            where = _machine.pc();
+            return STOP_BREAK;
+        }
+    }
+    where = _machine.pc();
+    return STOP_LIMIT;
+}
+
+History::Stop History::reverse(int & where)
+{
+    int wrote;
+    while (undo(wrote))
+    {
+        if (wrote >= 0 && watches.count(wrote))
+        {
+            where = wrote;
+            return STOP_WATCH;
+        }
+        if (breakpoints.count(_machine.pc()))
+        {
+            where = _machine.pc();
+            return STOP_BREAK;
+        }
+    }
+    where = _machine.pc();
+    return STOP_CHECKPOINT;
+}
@@ -0,0 +1,75 @@
+// Record/replay over a Simulator, for stepping backwards. LC-2K execution
+// is deterministic, so the state after n instructions is named by n alone:
+// a checkpoint is just an instruction count, and anything before it is
+// reached by replaying the program image from the start on the fast
+// engines.
+//
+// From the checkpoint on, every step logs only what it overwrote: the old
+// value of the register or memory word it wrote and the old pc when it
+// jumped, packed into 1 to 12 bytes with the tag last so the log can be
+// read backwards. Undo costs memory in proportion to the writes, never a
+// copy of memory.
+#ifndef LC2K_HISTORY_H
+#define LC2K_HISTORY_H
+
+#include "simulator.h"
+
+#include <vector>
+#include <set>
+#include <cstddef>
+
+class History
+{
+ public:
+    // What ended proceed() or reverse()
+    enum Stop { STOP_LIMIT, STOP_HALT, STOP_BREAK, STOP_WATCH, STOP_CHECKPOINT };
+
+    // `machine` holds a freshly loaded program; its state is count 0.
+    explicit History(Simulator & machine);
+
+    long long count() const { return _count; }
+    long long checkpoint() const { return _base; }
+    size_t logBytes() const { return _log.size(); }
+
+    // One instruction forward, logged; false once halted. Faults throw
+    // and leave the state as it was.
+    bool step();
+    // Undo the last logged instruction; false at the checkpoint.
+    bool back();
+    // Run up to `n` instructions on the machine's engine without logging
+    // and move the checkpoint there. Returns the number run. On a fault
+    // the machine is left just before the faulting instruction.
+    long long fastForward(long long n);
+    // Go to the state after `target` instructions, or to the halt if the
+    // program stops first: backwards through the log, forwards by
+    // stepping, or before the checkpoint by replaying from the start.
+    void seek(long long target);
+
+    // Stop before executing a breakpoint's pc, and after (or, going
+    // backwards, before) an instruction that writes a watched word.
+    std::set<int> breakpoints;
+    std::set<int> watches;
+    // Step forward until a stop, at most `limit` instructions when it is
+    // not negative; `where` gets the pc or address that stopped it.
+    Stop proceed(long long limit, int & where);
+    // Step backward until a stop or the checkpoint
+    Stop reverse(int & where);
+
+ private:
+    enum { LOG_REG = 0x1, LOG_MEM = 0x2, LOG_JUMP = 0x4, LOG_HALT = 0x8 };
+
+    Simulator & _machine;
+    std::vector<Simulator::word_t> _image;      // program image at count 0
+    int _pc0;
+    Simulator::word_t _reg0[8];
+    long long _count, _base;
+    std::vector<unsigned char> _log;
+
+    void restart();
+    bool record(int & wrote);
+    bool undo(int & wrote);
+    void put32(int v);
+    int get32(size_t at) const;
+};
+
+#endif
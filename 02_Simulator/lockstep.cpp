@@ -0,0 +1,327 @@
+#include "lockstep.h"
+
+#include <vector>
+#include <string>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LC2K_AVX2 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+typedef Lockstep::word_t word_t;
+
+enum { ADD, NAND, LW, SW, BEQ, JALR, HALT, NOOP };
+
+Lockstep::Lockstep(const word_t * words, int count, int lanes):
+    _lanes(lanes), _stride((lanes + WIDTH - 1) / WIDTH * WIDTH), _mem_c(count),
+    _page(NUMPAGES, (word_t *)NULL), _steps(0), _vector(supported())
+{
+    if (lanes < 1)
+        throw runtime_error("Lockstep needs at least one lane");
+    if (count < 0 || count > Simulator::MEMORY_WORDS)
+        throw runtime_error("Invalid program size");
+    _reg.assign(NUMREGS * _stride, 0);
+    _zero.assign(PAGE_SIZE * _stride, 0);
+    _pc.assign(_stride, 0);
+    _live.assign(_stride, 0);
+    _count.assign(_stride, 0);
+    _halted.assign(_stride, 0);
+    _error.resize(_stride);
+    for (int lane = 0; lane < lanes; ++lane)
+        _live[lane] = -1;
+    for (int addr = 0; addr < count; ++addr)
+    {
+        word_t * r = row(addr);
+        for (int lane = 0; lane < _stride; ++lane)
+            r[lane] = words[addr];
+    }
+}
+
+Lockstep::~Lockstep()
+{
+    for (int page = 0; page < NUMPAGES; ++page)
+        delete[] _page[page];
+}
+
+bool Lockstep::supported()
+{
+#ifdef LC2K_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+void Lockstep::setVectorized(bool on)
+{
+    _vector = on && supported();
+}
+
+word_t * Lockstep::row(int addr)
+{
+    word_t *& page = _page[addr >> PAGE_BITS];
+    if (!page)
+    {
+        page = new word_t[PAGE_SIZE * _stride];
+        memset(page, 0, sizeof(word_t) * PAGE_SIZE * _stride);
+    }
+    return page + (addr & (PAGE_SIZE - 1)) * _stride;
+}
+
+const word_t * Lockstep::row(int addr) const
+{
+    const word_t * page = _page[addr >> PAGE_BITS];
+    return (page ? page : _zero.data()) + (addr & (PAGE_SIZE - 1)) * _stride;
+}
+
+void Lockstep::poke(int lane, int addr, word_t value)
+{
+    if (lane < 0 || lane >= _lanes || addr < 0 || addr >= Simulator::MEMORY_WORDS)
+        throw runtime_error("Invalid memory access!");
+    row(addr)[lane] = value;
+}
+
+void Lockstep::fault(int lane)
+{
+    _live[lane] = 0;
+    _error[lane] = "Invalid memory access!";
+}
+
+// lw or sw for one lane; false when it faults
+inline bool Lockstep::memoryOp(int lane, const Simulator::Decoded & ins)
+{
+    int addr = _reg[ins.regA * _stride + lane] + ins.offset;
+    if (addr < 0 || addr >= Simulator::MEMORY_WORDS)
+    {
+        fault(lane);
+        return false;
+    }
+    if (ins.opcode == LW)
+        _reg[ins.regB * _stride + lane] = row(addr)[lane];
+    else
+        row(addr)[lane] = _reg[ins.regB * _stride + lane];
+    ++_pc[lane];
+    return true;
+}
+
+// The word the lanes at pc execute: that of the first of them
+inline word_t Lockstep::leader(int pc) const
+{
+    const word_t * code = row(pc);
+    for (int lane = 0; lane < _lanes; ++lane)
+        if (_live[lane] && _pc[lane] == pc)
+            return code[lane];
+    return 0;
+}
+
+int Lockstep::stepScalar(int pc, long long budget)
+{
+    const word_t word = leader(pc);
+    const Simulator::Decoded ins = Simulator::decode(word);
+    const word_t * code = row(pc);
+    word_t * const ra = &_reg[ins.regA * _stride];
+    word_t * const rb = &_reg[ins.regB * _stride];
+    word_t * const rd = &_reg[ins.destReg * _stride];
+    int next = INT_MAX;
+    for (int lane = 0; lane < _lanes; ++lane)
+    {
+        if (_live[lane] && _pc[lane] == pc && code[lane] == word)
+        {
+            bool retired = true;
+            switch (ins.opcode)
+            {
+                case ADD: rd[lane] = ra[lane] + rb[lane]; ++_pc[lane]; break;
+                case NAND: rd[lane] = ~(ra[lane] & rb[lane]); ++_pc[lane]; break;
+                case LW: case SW: retired = memoryOp(lane, ins); break;
+                case BEQ: _pc[lane] += 1 + (ra[lane] == rb[lane] ? ins.offset : 0); break;
+                case JALR:
+                    rb[lane] = pc + 1;
+                    _pc[lane] = ra[lane];
+                    break;
+                case HALT: _live[lane] = 0; _halted[lane] = 1; break;
+                case NOOP: ++_pc[lane]; break;
+            }
+            if (retired && ++_count[lane] == budget)
+                _live[lane] = 0;
+        }
+        if (_live[lane] && _pc[lane] < next)
+            next = _pc[lane];
+    }
+    return next;
+}
+
+#ifdef LC2K_AVX2
+// stepScalar() eight lanes at a time: add, nand, beq and jalr are vector
+// operations blended into the registers and pcs under the lane mask; lw
+// and sw go lane by lane since their addresses differ.
+__attribute__((target("avx2"))) int Lockstep::stepAvx2(int pc, long long budget)
+{
+    const word_t word = leader(pc);
+    const Simulator::Decoded ins = Simulator::decode(word);
+    const word_t * code = row(pc);
+    word_t * const ra = &_reg[ins.regA * _stride];
+    word_t * const rb = &_reg[ins.regB * _stride];
+    word_t * const rd = &_reg[ins.destReg * _stride];
+    const __m256i at = _mm256_set1_epi32(pc), same = _mm256_set1_epi32(word);
+    const __m256i one = _mm256_set1_epi32(1), ones = _mm256_set1_epi32(-1);
+    const __m256i offset = _mm256_set1_epi32(ins.offset);
+    __m256i next = _mm256_set1_epi32(INT_MAX);
+
+    for (int c = 0; c < _stride; c += WIDTH)
+    {
+        __m256i live = _mm256_loadu_si256((const __m256i *)&_live[c]);
+        __m256i pcs = _mm256_loadu_si256((const __m256i *)&_pc[c]);
+        __m256i m = _mm256_and_si256(live, _mm256_cmpeq_epi32(pcs, at));
+        if (!_mm256_testz_si256(m, m))
+        {
+            m = _mm256_and_si256(m, _mm256_cmpeq_epi32(
+                    _mm256_loadu_si256((const __m256i *)&code[c]), same));
+            __m256i a = _mm256_loadu_si256((const __m256i *)&ra[c]);
+            __m256i b = _mm256_loadu_si256((const __m256i *)&rb[c]);
+            switch (ins.opcode)
+            {
+                case ADD: case NAND:
+                {
+                    __m256i r = ins.opcode == ADD ? _mm256_add_epi32(a, b)
+                                                  : _mm256_xor_si256(_mm256_and_si256(a, b), ones);
+                    __m256i d = _mm256_loadu_si256((const __m256i *)&rd[c]);
+                    _mm256_storeu_si256((__m256i *)&rd[c], _mm256_blendv_epi8(d, r, m));
+                    pcs = _mm256_sub_epi32(pcs, m);
+                    break;
+                }
+                case LW: case SW:
+                {
+                    int bits = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+                    for (int i = 0; i < WIDTH; ++i)
+                        if ((bits >> i & 1) && !memoryOp(c + i, ins))
+                            bits &= ~(1 << i);
+                    // retired lanes only; memoryOp() moved their pcs
+                    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+                    m = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), bit), bit);
+                    live = _mm256_loadu_si256((const __m256i *)&_live[c]);
+                    pcs = _mm256_loadu_si256((const __m256i *)&_pc[c]);
+                    break;
+                }
+                case BEQ:
+                {
+                    __m256i taken = _mm256_and_si256(_mm256_cmpeq_epi32(a, b), offset);
+                    __m256i target = _mm256_add_epi32(_mm256_add_epi32(pcs, one), taken);
+                    pcs = _mm256_blendv_epi8(pcs, target, m);
+                    break;
+                }
+                case JALR:
+                {
+                    // the link is written first, as in next()
+                    __m256i link = _mm256_add_epi32(at, one);
+                    _mm256_storeu_si256((__m256i *)&rb[c], _mm256_blendv_epi8(b, link, m));
+                    a = _mm256_loadu_si256((const __m256i *)&ra[c]);
+                    pcs = _mm256_blendv_epi8(pcs, a, m);
+                    break;
+                }
+                case HALT:
+                {
+                    live = _mm256_andnot_si256(m, live);
+                    int bits = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+                    for (int i = 0; i < WIDTH; ++i)
+                        if (bits >> i & 1)
+                            _halted[c + i] = 1;
+                    break;
+                }
+                case NOOP:
+                    pcs = _mm256_sub_epi32(pcs, m);
+                    break;
+            }
+            _mm256_storeu_si256((__m256i *)&_pc[c], pcs);
+
+            // counts are 64-bit: four lanes per vector
+            __m256i lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(m));
+            __m256i hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(m, 1));
+            __m256i * count = (__m256i *)&_count[c];
+            __m256i clo = _mm256_sub_epi64(_mm256_loadu_si256(count), lo);
+            __m256i chi = _mm256_sub_epi64(_mm256_loadu_si256(count + 1), hi);
+            _mm256_storeu_si256(count, clo);
+            _mm256_storeu_si256(count + 1, chi);
+            if (budget >= 0)
+            {
+                // narrow the two 64-bit comparisons back to eight lanes
+                const __m256i limit = _mm256_set1_epi64x(budget - 1);
+                const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+                __m256i olo = _mm256_permutevar8x32_epi32(_mm256_cmpgt_epi64(clo, limit), even);
+                __m256i ohi = _mm256_permutevar8x32_epi32(_mm256_cmpgt_epi64(chi, limit), even);
+                live = _mm256_andnot_si256(_mm256_permute2x128_si256(olo, ohi, 0x20), live);
+            }
+            _mm256_storeu_si256((__m256i *)&_live[c], live);
+        }
+        next = _mm256_min_epi32(next, _mm256_blendv_epi8(_mm256_set1_epi32(INT_MAX), pcs, live));
+    }
+    __m128i m4 = _mm_min_epi32(_mm256_castsi256_si128(next), _mm256_extracti128_si256(next, 1));
+    m4 = _mm_min_epi32(m4, _mm_shuffle_epi32(m4, _MM_SHUFFLE(1, 0, 3, 2)));
+    m4 = _mm_min_epi32(m4, _mm_shuffle_epi32(m4, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(m4);
+}
+#endif
+
+long long Lockstep::run(long long budget)
+{
+    int pc = INT_MAX;
+    for (int lane = 0; lane < _lanes; ++lane)
+    {
+        if (budget >= 0 && _count[lane] >= budget)
+            _live[lane] = 0;
+        if (_live[lane] && _pc[lane] < pc)
+            pc = _pc[lane];
+    }
+
+    long long steps = 0;
+    while (pc != INT_MAX)
+    {
+        if ((unsigned)pc >= (unsigned)Simulator::MEMORY_WORDS)
+        {
+            // every lane there faults; go on with the rest
+            int next = INT_MAX;
+            for (int lane = 0; lane < _lanes; ++lane)
+            {
+                if (_live[lane] && _pc[lane] == pc)
+                    fault(lane);
+                if (_live[lane] && _pc[lane] < next)
+                    next = _pc[lane];
+            }
+            pc = next;
+            continue;
+        }
+#ifdef LC2K_AVX2
+        if (_vector)
+            pc = stepAvx2(pc, budget);
+        else
+#endif
+            pc = stepScalar(pc, budget);
+        ++steps;
+    }
+    _steps += steps;
+    return steps;
+}
+
+void Lockstep::exportLane(int lane, Simulator & machine) const
+{
+    vector<word_t> words(_mem_c);
+    for (int addr = 0; addr < _mem_c; ++addr)
+        words[addr] = row(addr)[lane];
+    machine.reset();
+    machine.setMC(words.data(), _mem_c);
+    machine.setPC(_pc[lane]);
+    for (int r = 0; r < NUMREGS; ++r)
+        machine.setReg(r, _reg[r * _stride + lane]);
+}
+
+double Lockstep::utilization() const
+{
+    long long retired = 0;
+    for (int lane = 0; lane < _lanes; ++lane)
+        retired += _count[lane];
+    return _steps ? (double)retired / ((double)_steps * _lanes) : 0;
+}
@@ -0,0 +1,90 @@
+// Lockstep engine: K independent instances ("lanes") of one program, each
+// with its own registers and memory, typically the same code run on
+// different data. State is stored lane-minor (structure of arrays):
+// register r of every lane is one row, and so is memory word a, so one
+// instruction is applied to eight lanes at a time with AVX2 where the CPU
+// has it, and lane by lane otherwise.
+//
+// Every step runs the instruction at the lowest pc any live lane is at,
+// for exactly the lanes at that pc whose word there matches; the others
+// are masked off. Lanes that diverge on beq or jalr wait until the
+// trailing group catches up with them and then run together again, so
+// structured code regroups by itself.
+#ifndef LC2K_LOCKSTEP_H
+#define LC2K_LOCKSTEP_H
+
+#include "simulator.h"
+
+#include <string>
+#include <vector>
+
+class Lockstep
+{
+ public:
+    typedef Simulator::word_t word_t;
+
+    // Every lane starts from `words` at pc 0 with zero registers.
+    Lockstep(const word_t * words, int count, int lanes);
+    ~Lockstep();
+    Lockstep(const Lockstep &) = delete;
+    Lockstep & operator=(const Lockstep &) = delete;
+
+    int lanes() const { return _lanes; }
+    void poke(int lane, int addr, word_t value);
+
+    // Run until every lane has halted, faulted or executed `budget`
+    // instructions (a negative budget means no limit). Returns the number
+    // of lockstep steps issued.
+    long long run(long long budget = -1);
+
+    long long count(int lane) const { return _count[lane]; }
+    bool halted(int lane) const { return _halted[lane]; }
+    // Empty unless the lane stopped on a fault
+    const std::string & error(int lane) const { return _error[lane]; }
+    // Loads the lane's pc, registers and program-sized memory into
+    // `machine`, so that the usual printing applies.
+    void exportLane(int lane, Simulator & machine) const;
+    // Instructions retired over lane slots issued
+    double utilization() const;
+    // The AVX2 code path is used when the CPU supports it, unless turned
+    // off here to compare against the lane-by-lane one.
+    static bool supported();
+    void setVectorized(bool on);
+    bool vectorized() const { return _vector; }
+
+ private:
+    static const int NUMREGS = 8;
+    static const int PAGE_BITS = 8;
+    static const int PAGE_SIZE = 1 << PAGE_BITS;
+    static const int NUMPAGES = Simulator::MEMORY_WORDS / PAGE_SIZE;
+    static const int WIDTH = 8;         // lanes per vector
+
+    int _lanes, _stride;                // stride: lanes rounded up to WIDTH
+    int _mem_c;
+    // row r holds register r of every lane, and row a of a page memory
+    // word a of every lane; pages get storage on first write
+    std::vector<word_t> _reg;
+    std::vector<word_t *> _page;
+    std::vector<word_t> _zero;
+    std::vector<word_t> _pc;
+    std::vector<word_t> _live;          // -1 for a lane still running
+    std::vector<long long> _count;
+    std::vector<char> _halted;
+    std::vector<std::string> _error;
+    long long _steps;
+    bool _vector;
+
+    word_t * row(int addr);
+    const word_t * row(int addr) const;
+    void fault(int lane);
+    inline bool memoryOp(int lane, const Simulator::Decoded & ins);
+    inline word_t leader(int pc) const;
+    // Execute the instruction at pc for the lanes there and return the
+    // lowest pc of the lanes still live
+    int stepScalar(int pc, long long budget);
+#if defined(__GNUC__) && defined(__x86_64__)
+    __attribute__((target("avx2"))) int stepAvx2(int pc, long long budget);
+#endif
+};
+
+#endif
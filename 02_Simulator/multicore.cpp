@@ -0,0 +1,117 @@
+#include "multicore.h"
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+using namespace std;
+
+Multicore::Multicore(Simulator & machine, int harts, long long quantum,
+                     unsigned long long seed):
+    _machine(machine), _harts(harts), _quantum(quantum), _seed(seed),
+    _state(seed), _switches(0)
+{
+    if (harts < 1 || quantum < 1)
+        throw runtime_error("A multi-hart run needs at least one hart and a positive quantum");
+    for (int id = 0; id < harts; ++id)
+    {
+        Hart & hart = _harts[id];
+        hart.pc = machine.pc();
+        for (int r = 0; r < 8; ++r)
+            hart.reg[r] = machine.reg(r);
+        hart.reg[HART_REG] = id;
+        hart.halted = false;
+        hart.count = 0;
+    }
+}
+
+// splitmix64, so that a seed names one schedule on every host
+long long Multicore::slice()
+{
+    if (!_seed)
+        return _quantum;
+    unsigned long long z = (_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return 1 + (long long)(z % (unsigned long long)_quantum);
+}
+
+void Multicore::enter(const Hart & hart)
+{
+    _machine.setPC(hart.pc);
+    for (int r = 0; r < 8; ++r)
+        _machine.setReg(r, hart.reg[r]);
+}
+
+void Multicore::leave(Hart & hart)
+{
+    hart.pc = _machine.pc();
+    for (int r = 0; r < 8; ++r)
+        hart.reg[r] = _machine.reg(r);
+}
+
+bool Multicore::halted() const
+{
+    for (size_t i = 0; i < _harts.size(); ++i)
+        if (!_harts[i].halted)
+            return false;
+    return true;
+}
+
+long long Multicore::run(long long budget)
+{
+    long long count = 0;
+    bool progress = true;
+    while (progress && (budget < 0 || count < budget))
+    {
+        progress = false;
+        for (size_t id = 0; id < _harts.size() && (budget < 0 || count < budget); ++id)
+        {
+            Hart & hart = _harts[id];
+            if (hart.halted)
+                continue;
+            long long n = slice();
+            if (budget >= 0 && n > budget - count)
+                n = budget - count;
+
+            enter(hart);
+            _machine.resume();
+            ++_switches;
+            long long done;
+            try
+            {
+                done = _machine.run(n);
+            }
+            catch (runtime_error & e)
+            {
+                leave(hart);
+                throw runtime_error("hart " + to_string(id) + ": " + e.what());
+            }
+            leave(hart);
+            hart.count += done;
+            hart.halted = _machine.halted();
+            count += done;
+            progress |= done > 0;
+        }
+    }
+    return count;
+}
+
+void Multicore::printSummary(long long count, ostream & os)
+{
+    enter(_harts[0]);
+    _machine.printSummary(count, halted(), os);
+    for (size_t id = 0; id < _harts.size(); ++id)
+    {
+        const Hart & hart = _harts[id];
+        os << "hart " << id << ": " << hart.count << " instructions, "
+           << (hart.halted ? "halted at pc " : "stopped at pc ") << hart.pc
+           << endl << "\tregisters:";
+        for (int r = 0; r < 8; ++r)
+            os << ' ' << hart.reg[r];
+        os << endl;
+    }
+    os << "context switches " << _switches << endl;
+    os.flush();
+}
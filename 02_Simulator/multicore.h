@@ -0,0 +1,62 @@
+// Several LC-2K harts sharing one memory image. The Simulator holds the
+// memory and runs whichever hart is scheduled; every hart has its own pc
+// and registers, starts at pc 0 with its hart id in HART_REG and the other
+// registers zero, and stops on its own halt. The run ends when every hart
+// has halted.
+//
+// Harts are interleaved round-robin on the calling thread: each gets a
+// slice of `quantum` instructions on the Simulator's engine, or, with a
+// seed, a pseudo-random slice of 1..quantum. The interleaving depends only
+// on (harts, quantum, seed), so any run is replayed exactly by giving the
+// same three values, whatever the engine.
+#ifndef LC2K_MULTICORE_H
+#define LC2K_MULTICORE_H
+
+#include "simulator.h"
+
+#include <iostream>
+#include <vector>
+
+class Multicore
+{
+ public:
+    static const int HART_REG = 1;
+
+    struct Hart
+    {
+        int pc;
+        Simulator::word_t reg[8];
+        bool halted;
+        long long count;            // instructions retired, halt included
+    };
+
+    // `machine` must have a program loaded; its pc and registers are
+    // replaced by those of hart 0. A zero seed means fixed slices.
+    Multicore(Simulator & machine, int harts, long long quantum,
+              unsigned long long seed = 0);
+
+    // Run until every hart has halted or `budget` instructions have been
+    // retired in total (a negative budget means no limit). Returns the
+    // number retired. A fault is rethrown with the hart that caused it.
+    long long run(long long budget = -1);
+    bool halted() const;
+    const std::vector<Hart> & harts() const { return _harts; }
+    long long switches() const { return _switches; }
+
+    // The usual summary with hart 0's registers, then one line per hart
+    // with its count, pc and registers.
+    void printSummary(long long count, std::ostream & os = std::cout);
+
+ private:
+    Simulator & _machine;
+    std::vector<Hart> _harts;
+    long long _quantum;
+    unsigned long long _seed, _state;
+    long long _switches;
+
+    long long slice();
+    void enter(const Hart & hart);
+    void leave(Hart & hart);
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include "pipeline.h"
+
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+
+using namespace std;
+
+typedef Simulator::word_t word_t;
+typedef Simulator::Decoded Decoded;
+
+enum { ADD, NAND, LW, SW, BEQ, JALR, HALT, NOOP };
+
+bool Pipeline::parsePredictor(const string & name, Predictor & predictor)
+{
+    if (name == "nottaken")
+        predictor = NOT_TAKEN;
+    else if (name == "backward")
+        predictor = BACKWARD_TAKEN;
+    else if (name == "bimodal")
+        predictor = BIMODAL;
+    else
+        return false;
+    return true;
+}
+
+const char * Pipeline::predictorName(Predictor predictor)
+{
+    static const char * const names[] = {"nottaken", "backward", "bimodal"};
+    return names[predictor];
+}
+
+Pipeline::Pipeline(Simulator & machine, Predictor predictor):
+    _machine(machine), _predictor(predictor), _bht(BHT_SIZE, 1), _stats()
+{
+}
+
+int Pipeline::destination(const Decoded & ins)
+{
+    switch (ins.opcode)
+    {
+        case ADD: case NAND: return ins.destReg;
+        case LW: case JALR: return ins.regB;
+        default: return -1;
+    }
+}
+
+bool Pipeline::reads(const Decoded & ins, int reg)
+{
+    switch (ins.opcode)
+    {
+        case ADD: case NAND: case SW: case BEQ:
+            return ins.regA == reg || ins.regB == reg;
+        case LW: case JALR:
+            return ins.regA == reg;
+        default:
+            return false;
+    }
+}
+
+// IF: read and decode the word at pc and predict what to fetch next
+Pipeline::Slot Pipeline::fetch(int pc)
+{
+    Slot slot = Slot();
+    slot.valid = true;
+    slot.pc = pc;
+    slot.predicted = pc + 1;
+    if ((unsigned)pc >= (unsigned)Simulator::MEMORY_WORDS)
+    {
+        // harmless unless it turns out to be on the right path
+        slot.badPc = true;
+        slot.ins = Simulator::decode(NOOP << 22);
+        slot.dest = -1;
+        return slot;
+    }
+    slot.ins = Simulator::decode(_machine.peek(pc));
+    slot.dest = destination(slot.ins);
+    if (slot.ins.opcode == BEQ)
+    {
+        bool taken = false;
+        switch (_predictor)
+        {
+            case NOT_TAKEN: taken = false; break;
+            case BACKWARD_TAKEN: taken = slot.ins.offset < 0; break;
+            case BIMODAL: taken = _bht[pc % BHT_SIZE] >= 2; break;
+        }
+        if (taken)
+            slot.predicted = pc + 1 + slot.ins.offset;
+    }
+    return slot;
+}
+
+// Stages are evaluated from WB back to IF, each reading the pipeline
+// registers as the previous cycle left them, so that a stage can see what
+// an older instruction did earlier in the same cycle.
+long long Pipeline::run(long long budget)
+{
+    Slot ifid = Slot(), idex = Slot(), exmem = Slot(), memwb = Slot();
+    int fetchPc = _machine.pc();
+    long long retired = 0;
+    if (_machine.halted() || budget == 0)
+        return 0;
+
+    for (;;)
+    {
+        ++_stats.cycles;
+        const Slot wb = memwb;
+
+        // WB
+        if (memwb.valid)
+        {
+            if (memwb.dest >= 0)
+                _machine.setReg(memwb.dest, memwb.result);
+            ++retired;
+            ++_stats.instructions;
+            _stats.loadUseStalls += memwb.stalled;
+            if (memwb.ins.opcode == BEQ)
+                ++_stats.branches;
+            else if (memwb.ins.opcode == JALR)
+                ++_stats.jumps;
+            if (memwb.ins.opcode == HALT)
+            {
+                // let the machine execute the halt itself so that it ends
+                // up halted exactly as after next()
+                _machine.setPC(memwb.pc);
+                _machine.next();
+                break;
+            }
+            _machine.setPC(memwb.next);
+            if (retired == budget)
+                break;
+        }
+
+        // MEM: the oldest instruction in flight, so it is on the right path
+        Slot newMemwb = exmem;
+        int redirect = 0;
+        bool flush = false, storeFlush = false;
+        if (exmem.valid)
+        {
+            if (exmem.badPc)
+                throw runtime_error("Invalid memory access!");
+            switch (exmem.ins.opcode)
+            {
+                case LW:
+                    if (exmem.result < 0 || exmem.result >= Simulator::MEMORY_WORDS)
+                        throw runtime_error("Invalid memory access!");
+                    newMemwb.result = _machine.peek(exmem.result);
+                    break;
+                case SW:
+                    if (exmem.result < 0 || exmem.result >= Simulator::MEMORY_WORDS)
+                        throw runtime_error("Invalid memory access!");
+                    _machine.poke(exmem.result, exmem.valB);
+                    // younger instructions fetched from the stored word
+                    // refetch it
+                    if ((idex.valid && idex.pc == exmem.result)
+                        || (ifid.valid && ifid.pc == exmem.result))
+                    {
+                        redirect = exmem.next;
+                        flush = storeFlush = true;
+                    }
+                    break;
+                case BEQ:
+                    if (_predictor == BIMODAL)
+                    {
+                        unsigned char & counter = _bht[exmem.pc % BHT_SIZE];
+                        if (exmem.next != exmem.pc + 1 && counter < 3)
+                            ++counter;
+                        else if (exmem.next == exmem.pc + 1 && counter > 0)
+                            --counter;
+                    }
+                    if (exmem.next != exmem.predicted)
+                    {
+                        redirect = exmem.next;
+                        flush = true;
+                        ++_stats.mispredicts;
+                    }
+                    break;
+                case JALR:
+                    if (exmem.next != exmem.predicted)
+                    {
+                        redirect = exmem.next;
+                        flush = true;
+                        ++_stats.redirects;
+                    }
+                    break;
+            }
+        }
+        memwb = newMemwb;
+        if (flush)
+        {
+            _stats.squashed += idex.valid + ifid.valid + 1;
+            _stats.storeFlushes += storeFlush;
+            // this cycle's fetch is wrong too; the right path starts next cycle
+            idex = ifid = exmem = Slot();
+            fetchPc = redirect;
+            continue;
+        }
+
+        // EX, with forwarding from the instructions in MEM and WB this
+        // cycle; the one in MEM is newer and wins
+        Slot newExmem = idex;
+        if (idex.valid)
+        {
+            Slot & in = newExmem;
+            const Slot * sources[] = {&exmem, &wb};
+            for (int i = 1; i >= 0; --i)
+            {
+                const Slot & from = *sources[i];
+                if (!from.valid || from.dest < 0)
+                    continue;
+                if (from.dest == in.ins.regA)
+                    in.valA = from.result;
+                if (from.dest == in.ins.regB)
+                    in.valB = from.result;
+            }
+            in.next = in.pc + 1;
+            switch (in.ins.opcode)
+            {
+                case ADD: in.result = in.valA + in.valB; break;
+                case NAND: in.result = ~(in.valA & in.valB); break;
+                case LW: case SW: in.result = in.valA + in.ins.offset; break;
+                case BEQ:
+                    if (in.valA == in.valB)
+                        in.next = in.pc + 1 + in.ins.offset;
+                    break;
+                case JALR:
+                    // the link is written first, as in next()
+                    in.result = in.pc + 1;
+                    in.next = in.ins.regA == in.ins.regB ? in.result : in.valA;
+                    break;
+            }
+        }
+        exmem = newExmem;
+
+        // ID: a load in EX stalls an instruction that needs its result
+        if (ifid.valid && idex.valid && idex.ins.opcode == LW && reads(ifid.ins, idex.dest))
+        {
+            idex = Slot();
+            ifid.stalled = true;
+            continue;
+        }
+        idex = ifid;
+        if (idex.valid)
+        {
+            idex.valA = _machine.reg(idex.ins.regA);
+            idex.valB = _machine.reg(idex.ins.regB);
+        }
+
+        // IF
+        ifid = fetch(fetchPc);
+        fetchPc = ifid.predicted;
+    }
+    return retired;
+}
+
+void Pipeline::printStats(ostream & os) const
+{
+    char line[160];
+    const Stats & s = _stats;
+    snprintf(line, sizeof(line), "pipeline (%s): %lld cycles, %lld instructions, CPI %.3f\n",
+             predictorName(_predictor), s.cycles, s.instructions,
+             s.instructions ? (double)s.cycles / s.instructions : 0.0);
+    os << line;
+    snprintf(line, sizeof(line), "\tload-use stalls %lld\n\tbeq %lld, mispredicted %lld (%.1f%%)\n",
+             s.loadUseStalls, s.branches, s.mispredicts,
+             s.branches ? 100.0 * s.mispredicts / s.branches : 0.0);
+    os << line;
+    snprintf(line, sizeof(line), "\tjalr %lld, redirected %lld\n\tsquashed %lld, store flushes %lld\n",
+             s.jumps, s.redirects, s.squashed, s.storeFlushes);
+    os << line;
+}
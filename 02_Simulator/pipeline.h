@@ -0,0 +1,85 @@
+// Five-stage pipeline timing model (IF/ID/EX/MEM/WB) of LC-2K. It runs
+// on a loaded Simulator, which holds the architectural registers and
+// memory: stores are committed in MEM and registers written in WB, so after
+// run() the Simulator is in the state the functional engines reach.
+//
+// Results are forwarded from EX/MEM and MEM/WB into EX, and the register
+// file is written before it is read within a cycle. A load followed by an
+// instruction that uses its result stalls one cycle. beq and jalr resolve
+// in MEM; a wrong prediction squashes the three younger instructions.
+// jalr is always predicted to fall through.
+#ifndef LC2K_PIPELINE_H
+#define LC2K_PIPELINE_H
+
+#include "simulator.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+class Pipeline
+{
+ public:
+    // beq prediction at fetch: never taken, taken when the branch goes
+    // backwards, or a table of 2-bit saturating counters indexed by pc
+    enum Predictor { NOT_TAKEN, BACKWARD_TAKEN, BIMODAL };
+    // "nottaken", "backward" or "bimodal"; false for anything else
+    static bool parsePredictor(const std::string & name, Predictor & predictor);
+    static const char * predictorName(Predictor predictor);
+
+    struct Stats
+    {
+        long long cycles;
+        long long instructions;     // retired, halt included
+        long long loadUseStalls;    // bubbles for load-use hazards on the right path
+        long long branches;         // beq retired
+        long long mispredicts;      // beq that squashed the wrong path
+        long long jumps;            // jalr retired
+        long long redirects;        // jalr that squashed the wrong path
+        long long squashed;         // wrong-path instructions flushed
+        long long storeFlushes;     // flushes for stores into fetched code
+    };
+
+    explicit Pipeline(Simulator & machine, Predictor predictor = NOT_TAKEN);
+
+    // Run from the machine's pc with an empty pipeline until halt retires
+    // or `budget` instructions have retired (a negative budget means no
+    // limit). Returns the number retired. Invalid addresses throw, like
+    // the functional engines, once the instruction is no longer
+    // speculative.
+    long long run(long long budget = -1);
+    const Stats & stats() const { return _stats; }
+    void printStats(std::ostream & os = std::cout) const;
+
+ private:
+    typedef Simulator::word_t word_t;
+
+    static const int BHT_SIZE = 1024;
+
+    // One pipeline register. `dest` is the register written in WB, -1
+    // for none.
+    struct Slot
+    {
+        bool valid;
+        bool badPc;                 // fetched from outside memory
+        bool stalled;               // waited a cycle in ID for a load
+        int pc;
+        Simulator::Decoded ins;
+        int predicted;              // pc fetched after this one
+        int next;                   // pc that really follows, known after EX
+        word_t valA, valB;
+        word_t result;              // ALU result, address or link value
+        int dest;
+    };
+
+    Simulator & _machine;
+    Predictor _predictor;
+    std::vector<unsigned char> _bht;
+    Stats _stats;
+
+    Slot fetch(int pc);
+    static int destination(const Simulator::Decoded & ins);
+    static bool reads(const Simulator::Decoded & ins, int reg);
+};
+
+#endif
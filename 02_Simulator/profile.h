@@ -0,0 +1,32 @@
+// Execution profile collected through Simulator::runObserved(): retired
+// instructions per pc and per opcode, beq outcomes, jalr edges and memory
+// reads and writes per address.
+#ifndef LC2K_PROFILE_H
+#define LC2K_PROFILE_H
+
+#include "simulator.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+struct Profile
+{
+    std::vector<long long> count;             // retired per pc
+    std::vector<long long> taken;             // beq taken per pc
+    std::vector<long long> reads, writes;     // lw/sw per address
+    long long opcode[8];
+    std::map<std::pair<int, int>, long long> jumps;    // (jalr pc, target)
+
+    Profile(): count(Simulator::MEMORY_WORDS), taken(Simulator::MEMORY_WORDS),
+               reads(Simulator::MEMORY_WORDS), writes(Simulator::MEMORY_WORDS), opcode()
+    {}
+
+    void retire(int pc, int op) { ++count[pc]; ++opcode[op]; }
+    void read(int addr) { ++reads[addr]; }
+    void write(int addr) { ++writes[addr]; }
+    void branch(int pc, bool wasTaken) { taken[pc] += wasTaken; }
+    void jump(int pc, int target) { ++jumps[std::make_pair(pc, target)]; }
+};
+
+#endif
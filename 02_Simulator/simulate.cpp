@@ -0,0 +1,943 @@
+#include "simulator.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "multicore.h"
+#include "lockstep.h"
+#include "analysis.h"
+#include "../common/archstate.h"
+
+#include <iostream>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+
+#include <vector>
+#include <string>
+
+#include <deque>
+#include <thread>
+#include <mutex>
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+typedef Simulator::mc_t mc_t;
+typedef Simulator::word_t word_t;
+
+// Runs every machine-code file named in a manifest on a pool of worker
+// threads. Each worker reuses one Simulator and owns a queue of jobs; a
+// worker whose queue runs dry steals from the back of the others. Results
+// are reported in manifest order.
+class BatchRunner
+{
+ public:
+    BatchRunner(const vector<string> & files, int workers,
+                long long budget, Simulator::Engine engine);
+    void run();
+    void write(ostream & os) const;
+
+ private:
+    struct Result
+    {
+        string reason;
+        long long count;
+        unsigned long long hash;
+    };
+    struct WorkQueue
+    {
+        mutex lock;
+        deque<int> jobs;
+    };
+
+    bool take(int self, int & job);
+    void work(int self);
+
+    vector<string> _files;
+    vector<Result> _results;
+    vector<WorkQueue> _queues;
+    long long _budget;
+    Simulator::Engine _engine;
+};
+
+BatchRunner::BatchRunner(const vector<string> & files, int workers,
+                         long long budget, Simulator::Engine engine)
+    : _files(files), _results(files.size()), _queues(workers),
+      _budget(budget), _engine(engine)
+{
+    for (size_t i = 0; i < files.size(); ++i)
+        _queues[i % workers].jobs.push_back(i);
+}
+
+bool BatchRunner::take(int self, int & job)
+{
+    {
+        lock_guard<mutex> guard(_queues[self].lock);
+        if (!_queues[self].jobs.empty())
+        {
+            job = _queues[self].jobs.front();
+            _queues[self].jobs.pop_front();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < _queues.size(); ++i)
+    {
+        WorkQueue & victim = _queues[(self + i) % _queues.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchRunner::work(int self)
+{
+    Simulator simulator;
+    simulator.setEngine(_engine);
+    int job;
+    while (take(self, job))
+    {
+        Result & result = _results[job];
+        result.count = 0;
+        result.hash = 0;
+        try
+        {
+            simulator.reset();
+            simulator.loadFromFile(_files[job]);
+            result.count = simulator.run(_budget);
+            result.reason = simulator.halted() ? "halted" : "budget";
+            result.hash = simulator.stateHash();
+        }
+        catch (runtime_error & e)
+        {
+            result.reason = string("error: ") + e.what();
+        }
+    }
+}
+
+void BatchRunner::run()
+{
+    vector<thread> threads;
+    for (size_t i = 0; i < _queues.size(); ++i)
+        threads.push_back(thread(&BatchRunner::work, this, int(i)));
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+}
+
+void BatchRunner::write(ostream & os) const
+{
+    os << "# file\treason\tinstructions\tstate_hash\n";
+    for (size_t i = 0; i < _files.size(); ++i)
+    {
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", _results[i].hash);
+        os << _files[i] << '\t' << _results[i].reason << '\t'
+           << _results[i].count << '\t' << hash << '\n';
+    }
+    os.flush();
+}
+
+static int runBatch(const string & manifest, const char * output, int workers,
+                    long long budget, Simulator::Engine engine)
+{
+    ifstream ifs(manifest.c_str());
+    if (!ifs)
+    {
+        cerr << "Invalid filename: " << manifest;
+        return EXIT_FAILURE;
+    }
+    vector<string> files;
+    string line;
+    while (getline(ifs, line))
+        if (!line.empty() && line[0] != '#')
+            files.push_back(line);
+
+    if (workers <= 0)
+        workers = max(1u, thread::hardware_concurrency());
+    BatchRunner runner(files, workers, budget, engine);
+    runner.run();
+
+    if (!output)
+    {
+        runner.write(cout);
+        return EXIT_SUCCESS;
+    }
+    ofstream ofs(output);
+    if (!ofs)
+    {
+        cerr << "Invalid filename: " << output;
+        return EXIT_FAILURE;
+    }
+    runner.write(ofs);
+    return EXIT_SUCCESS;
+}
+
+// Delta trace: the starting state followed by one record per step holding
+// only what the step changed, so the file grows with the number of writes
+// rather than with steps x memory. All integers are little-endian.
+//
+//   header   "LCDT", u32 version, i32 pc, i32 reg[8], i32 n, i32 mem[n]
+//   step     u8 tag, then by tag bit:
+//              TRACE_REG   u8 register, i32 value
+//              TRACE_MEM   u16 address, i32 value
+//              TRACE_JUMP  i32 new pc (otherwise pc advances by one)
+//   trailer  u8 TRACE_END, u8 halted, i64 instruction count
+//        or  u8 TRACE_FAULT, i64 instruction count, u16 n, char message[n]
+//
+// expandTrace() turns a trace back into the exact text of a tracing run,
+// including the error a faulting run ends with.
+static const char TRACE_MAGIC[4] = {'L', 'C', 'D', 'T'};
+static const unsigned TRACE_VERSION = 1;
+enum { TRACE_REG = 0x1, TRACE_MEM = 0x2, TRACE_JUMP = 0x4, TRACE_FAULT = 0x40, TRACE_END = 0x80 };
+
+class TraceWriter
+{
+ public:
+    explicit TraceWriter(ostream & os): _os(os) {}
+    void begin(const Simulator & simulator);
+    void step(int oldPC, const Simulator::Delta & delta);
+    void end(bool halted, long long count);
+    void fault(const string & message, long long count);
+
+ private:
+    void put8(int v) { _buf.push_back((char)v); }
+    void put16(int v) { put8(v); put8(v >> 8); }
+    void put32(int v) { put16(v); put16(v >> 16); }
+    void flush(bool force = false);
+
+    ostream & _os;
+    string _buf;
+};
+
+void TraceWriter::flush(bool force)
+{
+    if (force || _buf.size() >= (1 << 16))
+    {
+        _os.write(_buf.data(), _buf.size());
+        _buf.clear();
+    }
+}
+
+void TraceWriter::begin(const Simulator & simulator)
+{
+    _buf.append(TRACE_MAGIC, 4);
+    put32(TRACE_VERSION);
+    put32(simulator.pc());
+    for (int r = 0; r < 8; ++r)
+        put32(simulator.reg(r));
+    put32(simulator.memSize());
+    for (int i = 0; i < simulator.memSize(); ++i)
+    {
+        put32(simulator.peek(i));
+        flush();
+    }
+}
+
+void TraceWriter::step(int oldPC, const Simulator::Delta & delta)
+{
+    int tag = (delta.reg >= 0 ? TRACE_REG : 0) | (delta.addr >= 0 ? TRACE_MEM : 0)
+            | (delta.pc != oldPC + 1 ? TRACE_JUMP : 0);
+    put8(tag);
+    if (tag & TRACE_REG)
+    {
+        put8(delta.reg);
+        put32(delta.regValue);
+    }
+    if (tag & TRACE_MEM)
+    {
+        put16(delta.addr);
+        put32(delta.memValue);
+    }
+    if (tag & TRACE_JUMP)
+        put32(delta.pc);
+    flush();
+}
+
+void TraceWriter::end(bool halted, long long count)
+{
+    put8(TRACE_END);
+    put8(halted);
+    put32((int)count);
+    put32((int)(count >> 32));
+    flush(true);
+}
+
+void TraceWriter::fault(const string & message, long long count)
+{
+    const int n = (int)min(message.size(), size_t(0xffff));
+    put8(TRACE_FAULT);
+    put32((int)count);
+    put32((int)(count >> 32));
+    put16(n);
+    _buf.append(message, 0, n);
+    flush(true);
+}
+
+// Replays a delta trace through a Simulator so that printing goes through
+// the very same printInit()/printState() as a tracing run.
+static int expandTrace(const char * filename)
+{
+    ifstream ifs(filename, ios::binary);
+    if (!ifs)
+    {
+        cerr << "Invalid filename: " << filename;
+        return EXIT_FAILURE;
+    }
+    string data((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+    const unsigned char * p = (const unsigned char *)data.data();
+    const unsigned char * const end = p + data.size();
+
+    struct Reader
+    {
+        const unsigned char *& p;
+        const unsigned char * end;
+        bool ok(size_t n) const { return size_t(end - p) >= n; }
+        int get8() { return *p++; }
+        int get16() { int v = p[0] | p[1] << 8; p += 2; return v; }
+        int get32() { unsigned v = p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24; p += 4; return (int)v; }
+    } in = {p, end};
+
+    if (!in.ok(8 + 40) || memcmp(p, TRACE_MAGIC, 4) != 0)
+    {
+        cerr << "Not a delta trace: " << filename;
+        return EXIT_FAILURE;
+    }
+    p += 4;
+    if ((unsigned)in.get32() != TRACE_VERSION)
+    {
+        cerr << "Unsupported trace version: " << filename;
+        return EXIT_FAILURE;
+    }
+    int pc = in.get32();
+    word_t reg[8];
+    for (int r = 0; r < 8; ++r)
+        reg[r] = in.get32();
+    int n = in.get32();
+    if (n < 0 || !in.ok(size_t(n) * 4))
+    {
+        cerr << "Truncated trace: " << filename;
+        return EXIT_FAILURE;
+    }
+    vector<mc_t> image(n);
+    for (int i = 0; i < n; ++i)
+        image[i] = in.get32();
+
+    Simulator simulator;
+    simulator.setMC(image);
+    simulator.setPC(pc);
+    for (int r = 0; r < 8; ++r)
+        simulator.setReg(r, reg[r]);
+    simulator.printInit();
+    simulator.printState();
+
+    long long count = 0;
+    while (in.ok(1))
+    {
+        int tag = in.get8();
+        if (tag == TRACE_END)
+        {
+            if (!in.ok(9))
+                break;
+            bool halted = in.get8();
+            long long total = (unsigned)in.get32();
+            total |= (long long)in.get32() << 32;
+            if (total != count)
+                break;
+            simulator.printSummary(count, halted);
+            return EXIT_SUCCESS;
+        }
+        if (tag == TRACE_FAULT)
+        {
+            if (!in.ok(10))
+                break;
+            long long total = (unsigned)in.get32();
+            total |= (long long)in.get32() << 32;
+            size_t n = in.get16();
+            if (total != count || !in.ok(n))
+                break;
+            cerr << string((const char *)p, n);
+            return EXIT_FAILURE;
+        }
+        size_t need = (tag & TRACE_REG ? 5 : 0) + (tag & TRACE_MEM ? 6 : 0)
+                    + (tag & TRACE_JUMP ? 4 : 0);
+        if (!in.ok(need))
+            break;
+        if (tag & TRACE_REG)
+        {
+            int r = in.get8();
+            simulator.setReg(r & 7, in.get32());
+        }
+        if (tag & TRACE_MEM)
+        {
+            int addr = in.get16();
+            simulator.poke(addr, in.get32());
+        }
+        simulator.setPC(tag & TRACE_JUMP ? in.get32() : simulator.pc() + 1);
+        simulator.printState();
+        ++count;
+    }
+    cerr << "Truncated trace: " << filename;
+    return EXIT_FAILURE;
+}
+
+// Sampled simulation: the functional engine runs ahead, and every
+// `period` instructions hands pc, registers and the pages written since
+// the last hand-over (common/archstate.h) to the FSM simulator running as
+// `fsm -s`, which counts the cycles of the next `window` instructions. The
+// functional engine runs the window too, while the FSM is busy with it,
+// and both must agree on where it ended. CPI is estimated as total sampled
+// cycles over total sampled instructions, with a normal-approximation 95%
+// interval that shrinks to nothing when every instruction is sampled.
+class Sampler
+{
+ public:
+    Sampler(const string & fsm, long long window, long long period);
+    ~Sampler();
+    long long run(Simulator & simulator, long long budget);
+    void printStats(long long count, ostream & os = cout) const;
+
+ private:
+    void spawn();
+    void send(Simulator & simulator, long long window);
+    void finish();
+
+    string _fsm;
+    long long _window, _period;
+    pid_t _pid;
+    FILE * _to;
+    FILE * _from;
+    vector<long long> _instructions, _cycles;
+};
+
+Sampler::Sampler(const string & fsm, long long window, long long period)
+    : _fsm(fsm), _window(window), _period(period), _pid(-1), _to(NULL), _from(NULL)
+{
+}
+
+Sampler::~Sampler()
+{
+    finish();
+}
+
+void Sampler::spawn()
+{
+    int in[2], out[2];
+    if (pipe(in) != 0 || pipe(out) != 0)
+        throw runtime_error("pipe failed");
+    _pid = fork();
+    if (_pid < 0)
+        throw runtime_error("fork failed");
+    if (_pid == 0)
+    {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        execl(_fsm.c_str(), _fsm.c_str(), "-s", (char *)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    _to = fdopen(in[1], "wb");
+    _from = fdopen(out[0], "r");
+    // a dead FSM simulator shows up as a missing answer, not as SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+}
+
+void Sampler::finish()
+{
+    if (_to)
+        fclose(_to);
+    if (_from)
+        fclose(_from);
+    if (_pid > 0)
+        waitpid(_pid, NULL, 0);
+    _to = _from = NULL;
+    _pid = -1;
+}
+
+void Sampler::send(Simulator & simulator, long long window)
+{
+    const vector<int> & pages = simulator.dirtyPages();
+    ArchState state;
+    state.pc = simulator.pc();
+    for (int r = 0; r < ARCH_NUMREGS; ++r)
+        state.reg[r] = simulator.reg(r);
+    state.numMemory = simulator.memSize();
+    state.window = (unsigned)window;
+    state.pages = pages.size();
+    bool ok = arch_write(_to, &state) == 0;
+    for (size_t i = 0; ok && i < pages.size(); ++i)
+        ok = arch_write_page(_to, pages[i], simulator.pageWords(pages[i])) == 0;
+    if (!ok || fflush(_to) != 0)
+        throw runtime_error("Can not hand the state to the FSM simulator " + _fsm);
+    simulator.clearDirty();
+}
+
+long long Sampler::run(Simulator & simulator, long long budget)
+{
+    spawn();
+    long long count = 0;
+    while (!simulator.halted() && (budget < 0 || count < budget))
+    {
+        long long skip = _period - _window;
+        if (budget >= 0)
+            skip = min(skip, budget - count);
+        count += simulator.run(skip);
+        if (simulator.halted() || count == budget)
+            break;
+
+        long long window = budget < 0 ? _window : min(_window, budget - count);
+        send(simulator, window);
+        long long done = simulator.run(window);
+        long long instructions, cycles;
+        int halted;
+        if (fscanf(_from, "%lld %lld %d", &instructions, &cycles, &halted) != 3)
+            throw runtime_error("The FSM simulator " + _fsm + " gave no answer");
+        if (instructions != done || (halted != 0) != simulator.halted())
+            throw runtime_error("The FSM simulator disagrees on the window after instruction "
+                                + to_string(count));
+        _instructions.push_back(instructions);
+        _cycles.push_back(cycles);
+        count += done;
+    }
+    finish();
+    return count;
+}
+
+void Sampler::printStats(long long count, ostream & os) const
+{
+    char line[160];
+    size_t n = _instructions.size();
+    long long x = 0, y = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        x += _instructions[i];
+        y += _cycles[i];
+    }
+    snprintf(line, sizeof(line), "sampled %zu windows of %lld every %lld instructions: %lld of %lld in detail\n",
+             n, _window, _period, x, count);
+    os << line;
+    if (!x)
+        return;
+
+    double cpi = (double)y / x;
+    if (n < 2)
+    {
+        snprintf(line, sizeof(line), "\tCPI %.3f\n\tcycles %.0f\n", cpi, cpi * count);
+        os << line;
+        return;
+    }
+    // variance of the ratio estimator, with the finite population correction
+    double ss = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        double d = _cycles[i] - cpi * _instructions[i];
+        ss += d * d;
+    }
+    double mean = (double)x / n;
+    double covered = count ? (double)x / count : 1;
+    double half = 1.96 * sqrt(max(0.0, 1 - covered) * ss / (n - 1) / n) / mean;
+    snprintf(line, sizeof(line), "\tCPI %.3f +- %.3f (95%%)\n\tcycles %.0f +- %.0f (95%%)\n",
+             cpi, half, cpi * count, half * count);
+    os << line;
+}
+
+// Runs one program on every lane described in `lanesFile`, one lane per
+// line of "address=value" words to change in the program image ('#'
+// starts a comment; lines without any are skipped), and prints each
+// lane's summary after a "lane <n>" line.
+static int runLanes(const char * filename, const char * lanesFile, long long budget, bool scalar)
+{
+    ifstream ifs(lanesFile);
+    if (!ifs)
+    {
+        cerr << "Invalid filename: " << lanesFile;
+        return EXIT_FAILURE;
+    }
+    vector<vector<pair<int, word_t> > > patches;
+    string line;
+    for (int lineno = 1; getline(ifs, line); ++lineno)
+    {
+        line = line.substr(0, line.find('#'));
+        istringstream in(line);
+        vector<pair<int, word_t> > lane;
+        string item;
+        while (in >> item)
+        {
+            int addr;
+            long long value;
+            char rest;
+            if (sscanf(item.c_str(), "%d=%lld%c", &addr, &value, &rest) != 2
+                || addr < 0 || addr >= Simulator::MEMORY_WORDS)
+            {
+                cerr << lanesFile << ":" << lineno << ": expected address=value, got " << item;
+                return EXIT_FAILURE;
+            }
+            lane.push_back(make_pair(addr, (word_t)value));
+        }
+        if (!lane.empty())
+            patches.push_back(lane);
+    }
+    if (patches.empty())
+    {
+        cerr << "No lanes in " << lanesFile;
+        return EXIT_FAILURE;
+    }
+
+    Simulator simulator;
+    bool failed = false;
+    try
+    {
+        simulator.loadFromFile(filename);
+        vector<word_t> words(simulator.memSize());
+        for (int i = 0; i < simulator.memSize(); ++i)
+            words[i] = simulator.peek(i);
+
+        Lockstep lanes(words.data(), words.size(), patches.size());
+        lanes.setVectorized(!scalar);
+        for (size_t lane = 0; lane < patches.size(); ++lane)
+            for (auto & patch: patches[lane])
+                lanes.poke(lane, patch.first, patch.second);
+        long long steps = lanes.run(budget);
+
+        for (int lane = 0; lane < lanes.lanes(); ++lane)
+        {
+            cout << "lane " << lane << endl;
+            if (!lanes.error(lane).empty())
+            {
+                cout << lanes.error(lane) << endl;
+                failed = true;
+                continue;
+            }
+            lanes.exportLane(lane, simulator);
+            simulator.printSummary(lanes.count(lane), lanes.halted(lane));
+        }
+        char summary[160];
+        snprintf(summary, sizeof(summary), "lockstep (%s): %d lanes, %lld steps, lane utilization %.1f%%\n",
+                 lanes.vectorized() ? "avx2" : "scalar", lanes.lanes(), steps, 100 * lanes.utilization());
+        cout << summary;
+    }
+    catch (runtime_error & e)
+    {
+        cerr << e.what();
+        return EXIT_FAILURE;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [-q] [-n <budget>] [-e <engine>] [-s <snapshot> [-k <n>]] <filename>" << endl
+              << "       " << prog << " [-n <budget>] -p <predictor> <filename>" << endl
+              << "       " << prog << " [-n <budget>] -c <cache> <filename>" << endl
+              << "       " << prog << " [-n <budget>] [-e <engine>] -H <harts> [-Q <quantum>] [-r <seed>] <filename>" << endl
+              << "       " << prog << " [-n <budget>] [-e <engine>] -S <fsm binary> [-W <window>] [-P <period>] <filename>" << endl
+              << "       " << prog << " [-n <budget>] -L <lanes> [--scalar] <filename>" << endl
+              << "       " << prog << " [-n <budget>] -l [--verify] <filename>" << endl
+              << "       " << prog << " [-q] [-n <budget>] [-e <engine>] [-s <snapshot> [-k <n>]] --resume <snapshot>" << endl
+              << "       " << prog << " -b <manifest> [-o <results>] [-j <threads>] [-n <budget>] [-e <engine>]" << endl
+              << "       " << prog << " -x <trace>" << endl
+              << "  -q           batch mode: no per-instruction trace, print only the final state" << endl
+              << "  -t <trace>   like -q, and write a binary delta trace of every step to <trace>" << endl
+              << "  -x <trace>   expand a delta trace back into the text of a tracing run" << endl
+              << "  -n <budget>  stop after <budget> instructions" << endl
+              << "  -s <file>    save a snapshot of the machine there when the run stops" << endl
+              << "  -k <n>       with -s, also save a snapshot every <n> instructions" << endl
+              << "  --resume <file>  continue from a snapshot instead of loading <filename>" << endl
+              << "  -e <engine>  engine for -q, -H, -S and -b: switch (default), threaded, superblock or jit" << endl
+              << "  -p <predictor>  like -q, on the five-stage pipeline model with beq prediction" << endl
+              << "               nottaken, backward or bimodal; prints pipeline statistics too" << endl
+              << "  -c <cache>   like -q, with fetches, lw and sw going through a cache model, e.g." << endl
+              << "               size=1024,block=4,ways=2,write=back,hit=1,memory=20[,unified] or default;" << endl
+              << "               prints hit rates and memory cycles too" << endl
+              << "  -H <harts>   like -q, with <harts> harts sharing memory, each starting at pc 0" << endl
+              << "               with its id in reg 1; prints per-hart counts and registers too" << endl
+              << "  -Q <n>       instructions a hart runs before the next one is scheduled (1000)" << endl
+              << "  -r <seed>    random slices of 1..<quantum> instructions; the same harts," << endl
+              << "               quantum and seed replay the same interleaving" << endl
+              << "  -S <fsm>     like -q, and every <period> instructions hand the state to the FSM" << endl
+              << "               simulator binary <fsm> to count the cycles of the next <window>" << endl
+              << "               ones; prints the estimated CPI and cycles with 95% intervals" << endl
+              << "  -W <n>       instructions per detailed window (1000)" << endl
+              << "  -P <n>       instructions from one window to the next (100000)" << endl
+              << "  -L <lanes>   run one instance of the program per line of <lanes> in lockstep," << endl
+              << "               each line listing address=value words to change; prints every" << endl
+              << "               lane's final state after a \"lane <n>\" line" << endl
+              << "  --scalar     with -L, step the lanes one by one instead of with AVX2" << endl
+              << "  -l           like -q, on the reference interpreter with register-only loops" << endl
+              << "               replaced by their closed forms; prints how much was skipped too" << endl
+              << "  --verify     with -l, execute every skipped loop as well and stop if the" << endl
+              << "               closed form disagrees" << endl
+              << "  -b <file>    run every machine-code file listed in <file> in parallel" << endl
+              << "  -o <file>    write the per-file results there instead of stdout" << endl
+              << "  -j <n>       worker threads for -b (default: one per core)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Simulator simulator;
+    Simulator::Engine engine = Simulator::SWITCH;
+    bool engineSet = false;
+    Pipeline::Predictor predictor;
+    bool pipeline = false;
+    Cache::Config cache;
+    CacheModel::Timing timing;
+    bool cached = false, unified = false;
+    int harts = 0;
+    bool multi = false;
+    long long quantum = 1000;
+    unsigned long long seed = 0;
+    const char *fsm = NULL;
+    long long window = 1000, period = 100000;
+    const char *lanes = NULL;
+    bool scalar = false;
+    bool skipLoops = false, verify = false;
+    bool quiet = false;
+    long long budget = -1;
+    const char *filename = NULL;
+    const char *manifest = NULL;
+    const char *output = NULL;
+    const char *trace = NULL;
+    const char *snapshot = NULL;
+    const char *resume = NULL;
+    long long every = 0;
+    int workers = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "-q")
+            quiet = true;
+        else if (arg == "-t" && i + 1 < argc)
+            trace = argv[++i];
+        else if (arg == "-x" && i + 1 < argc)
+            return expandTrace(argv[i + 1]);
+        else if (arg == "-n" && i + 1 < argc)
+            budget = atoll(argv[++i]);
+        else if (arg == "-s" && i + 1 < argc)
+            snapshot = argv[++i];
+        else if (arg == "-k" && i + 1 < argc)
+            every = atoll(argv[++i]);
+        else if (arg == "--resume" && i + 1 < argc)
+            resume = argv[++i];
+        else if (arg == "-e" && i + 1 < argc)
+        {
+            if (!Simulator::parseEngine(argv[++i], engine))
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            engineSet = true;
+        }
+        else if (arg == "-p" && i + 1 < argc)
+        {
+            if (!Pipeline::parsePredictor(argv[++i], predictor))
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            pipeline = true;
+        }
+        else if (arg == "-c" && i + 1 < argc)
+        {
+            string error;
+            if (!CacheModel::parse(argv[++i], cache, timing, unified, error))
+            {
+                cerr << error << endl;
+                return EXIT_FAILURE;
+            }
+            cached = true;
+        }
+        else if (arg == "-H" && i + 1 < argc)
+            harts = atoi(argv[++i]), multi = true;
+        else if (arg == "-Q" && i + 1 < argc)
+            quantum = atoll(argv[++i]);
+        else if (arg == "-r" && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (arg == "-S" && i + 1 < argc)
+            fsm = argv[++i];
+        else if (arg == "-W" && i + 1 < argc)
+            window = atoll(argv[++i]);
+        else if (arg == "-P" && i + 1 < argc)
+            period = atoll(argv[++i]);
+        else if (arg == "-L" && i + 1 < argc)
+            lanes = argv[++i];
+        else if (arg == "--scalar")
+            scalar = true;
+        else if (arg == "-l")
+            skipLoops = true;
+        else if (arg == "--verify")
+            verify = true;
+        else if (arg == "-b" && i + 1 < argc)
+            manifest = argv[++i];
+        else if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "-j" && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (!filename && arg[0] != '-')
+            filename = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    const bool sampled = fsm != NULL;
+    if (verify && !skipLoops)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (lanes && filename && !resume && !manifest && !trace && !snapshot
+        && !pipeline && !cached && !multi && !sampled && !engineSet)
+        return runLanes(filename, lanes, budget, scalar);
+    if (lanes || scalar)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (manifest && !filename && !pipeline && !cached && !multi && !sampled)
+        return runBatch(manifest, output, workers, budget, engine);
+    if (!filename == !resume || manifest || (every && !snapshot)
+        || ((pipeline || cached || multi || sampled || skipLoops) && (trace || snapshot || resume))
+        || pipeline + cached + multi + sampled + skipLoops > 1
+        || (multi && harts < 1) || quantum < 1 || window < 1 || period < window
+        || (engineSet && (pipeline || cached || skipLoops || trace || !(quiet || multi || sampled))))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    long long count = 0;
+    simulator.setEngine(engine);
+    try
+    {
+        if (resume)
+            count = simulator.loadSnapshot(resume);
+        else
+            simulator.loadFromFile(filename);
+        // -n counts from the start of the original run, so a resumed run
+        // stops where an uninterrupted one would
+        const long long start = count;
+        if (pipeline)
+        {
+            Pipeline model(simulator, predictor);
+            count = model.run(budget);
+            simulator.printSummary(count, simulator.halted());
+            model.printStats();
+            return EXIT_SUCCESS;
+        }
+        if (cached)
+        {
+            CacheModel model(cache, timing, unified);
+            count = simulator.runObserved(model, budget);
+            simulator.printSummary(count, simulator.halted());
+            model.printStats();
+            return EXIT_SUCCESS;
+        }
+        if (multi)
+        {
+            Multicore machine(simulator, harts, quantum, seed);
+            count = machine.run(budget);
+            machine.printSummary(count);
+            return EXIT_SUCCESS;
+        }
+        if (skipLoops)
+        {
+            LoopSkipper skipper(simulator, verify);
+            count = skipper.run(budget);
+            simulator.printSummary(count, simulator.halted());
+            skipper.printStats(count);
+            return EXIT_SUCCESS;
+        }
+        if (sampled)
+        {
+            Sampler sampler(fsm, window, period);
+            count = sampler.run(simulator, budget);
+            simulator.printSummary(count, simulator.halted());
+            sampler.printStats(count);
+            return EXIT_SUCCESS;
+        }
+        if (trace)
+        {
+            ofstream ofs(trace, ios::binary);
+            if (!ofs)
+                throw runtime_error(string("Invalid filename: ") + trace);
+            TraceWriter writer(ofs);
+            Simulator::Delta delta;
+            writer.begin(simulator);
+            try
+            {
+                for (int pc = simulator.pc();
+                     (budget < 0 || count < budget) && simulator.next(delta);
+                     pc = delta.pc)
+                {
+                    writer.step(pc, delta);
+                    count++;
+                    if (every && count % every == 0)
+                        simulator.saveSnapshot(snapshot, count);
+                }
+            }
+            catch (runtime_error & e)
+            {
+                // keep the steps up to the fault readable
+                writer.fault(e.what(), count - start);
+                throw;
+            }
+            writer.end(simulator.halted(), count - start);
+        }
+        else if (quiet)
+        {
+            // run in slices between checkpoints
+            while (!simulator.halted() && (budget < 0 || count < budget))
+            {
+                long long slice = budget < 0 ? -1 : budget - count;
+                if (every && (slice < 0 || slice > every - count % every))
+                    slice = every - count % every;
+                long long done = simulator.run(slice);
+                count += done;
+                if (every && count % every == 0)
+                    simulator.saveSnapshot(snapshot, count);
+                if (done == 0)
+                    break;
+            }
+        }
+        else
+        {
+            // a resumed trace carries on from the snapshot's state
+            if (!resume)
+            {
+                simulator.printInit();
+                simulator.printState();
+            }
+
+            while ((budget < 0 || count < budget) && simulator.next())
+            {
+                simulator.printState();
+                count++;
+                if (every && count % every == 0)
+                    simulator.saveSnapshot(snapshot, count);
+            }
+        }
+        if (snapshot)
+            simulator.saveSnapshot(snapshot, count);
+        simulator.printSummary(count, simulator.halted());
+    }
+    catch (runtime_error & e)
+    {
+        cerr << e.what(); 
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,3 +1,5 @@
+#include "simulator.h"
+
 #include <iostream>
 #include <cstdio>
 #include <fstream>
@@ -8,128 +10,143 @@
 #include <stdexcept>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
+#include <cstddef>
 
-using namespace std;
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define LC2K_JIT 1
+#include <sys/mman.h>
+#endif
 
-typedef unsigned int mc_t;
-typedef int word_t;
+#include "../common/mapfile.h"
+#include "../common/objfile.h"
 
-class Simulator
-{
- private:
-    static const int NUMMEMORY = 65536;
-    static const int NUMREGS = 8;
-
-    word_t _reg[NUMREGS];
-    word_t * _mem;
-
-    int _mem_c, _pc;
-    bool _ready;
-    bool _end;
-
-    inline void runAdd(mc_t );
-    inline void runNand(mc_t );
-    inline void runLw(mc_t );
-    inline void runSw(mc_t );
-    inline void runBeq(mc_t );
-    inline void runJalr(mc_t );
-    inline void runHalt(mc_t );
-    inline void runNoop(mc_t );
-
-    inline word_t getOffset(mc_t );
- public:
-    Simulator(): _mem(new word_t [NUMMEMORY]), _ready(false) {}
-    ~Simulator() { if (_mem) delete [] _mem; }
-
-    void loadFromFile(string filename);
-    void setMC(const vector<mc_t> &mc);
-    void printInit(ostream & os = cout);
-    void printState(ostream & os = cout);
-    bool next();
-};
-
-void Simulator::runAdd(mc_t mc)
-{
-    mc_t regA = (mc >> 19) & 0x7;
-    mc_t regB = (mc >> 16) & 0x7;
-    mc_t regC = (mc >> 0) & 0x7;
+#if defined(__unix__) || defined(__APPLE__)
+#define LC2K_MMAP 1
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
-    _reg[regC] = _reg[regA]+_reg[regB];
-    ++_pc;
-}
+using namespace std;
 
-void Simulator::runNand(mc_t mc)
-{
-    mc_t regA = (mc >> 19) & 0x7;
-    mc_t regB = (mc >> 16) & 0x7;
-    mc_t regC = (mc >> 0) & 0x7;
+typedef Simulator::mc_t mc_t;
+typedef Simulator::word_t word_t;
 
 
-    _reg[regC] = ~(_reg[regA] & _reg[regB]);
+void Simulator::runAdd(const Decoded & ins)
+{
+    _reg[ins.destReg] = _reg[ins.regA]+_reg[ins.regB];
     ++_pc;
 }
 
-word_t Simulator::getOffset(mc_t mc)
+void Simulator::runNand(const Decoded & ins)
 {
-    mc_t offset = mc & ((1 << 16) - 1);
-    if (offset & (1 << 15))
-        return int(offset - (1 << 16));
-    else
-        return offset;
+    _reg[ins.destReg] = ~(_reg[ins.regA] & _reg[ins.regB]);
+    ++_pc;
 }
 
-void Simulator::runLw(mc_t mc)
+void Simulator::runLw(const Decoded & ins)
 {
-    mc_t regA = (mc >> 19) & 0x7;
-    mc_t regB = (mc >> 16) & 0x7;
-    int basic_addr = _reg[regA],
-        shifted = getOffset(mc);
-    int addr = basic_addr + shifted;
+    int addr = _reg[ins.regA] + ins.offset;
     if (addr < 0 || addr >= NUMMEMORY)
         throw runtime_error("Invalid memory access!");
-    _reg[regB] = _mem[addr];
+    _reg[ins.regB] = load(addr);
     ++_pc;
 }
 
-void Simulator::runSw(mc_t mc)
+void Simulator::runSw(const Decoded & ins)
 {
-    mc_t regA = (mc >> 19) & 0x7;
-    mc_t regB = (mc >> 16) & 0x7;
-    int basic_addr = _reg[regA],
-        shifted = getOffset(mc);
-    int addr = basic_addr + shifted;
+    int addr = _reg[ins.regA] + ins.offset;
     if (addr < 0 || addr >= NUMMEMORY)
         throw runtime_error("Invalid memory access!");
-    _mem[addr] = _reg[regB];
+    storeWord(addr, _reg[ins.regB]);
     ++_pc;
 }
 
-void Simulator::runBeq(mc_t mc)
+void Simulator::storeWord(int addr, word_t value)
 {
-    mc_t regA = (mc >> 19) & 0x7;
-    mc_t regB = (mc >> 16) & 0x7;
+    Page * page = _wpage[addr >> PAGE_BITS];
+    if (!page)
+        page = touchPage(addr >> PAGE_BITS);
+    page->word[addr & PAGE_MASK] = value;
+    // keep the decoded copy and translated blocks in step for
+    // self-modifying programs
+    page->dec[addr & PAGE_MASK] = decode(value);
+    if (!_code.empty() && _code[addr])
+        flushBlocks();
+}
 
-    if (_reg[regA] == _reg[regB])
-        _pc += getOffset(mc);
-    ++_pc;
+const Simulator::Page Simulator::ZERO_PAGE = Simulator::Page();
+
+Simulator::Page * Simulator::touchPage(int page)
+{
+    if (!_own[page])
+    {
+        Page * fresh;
+        if (_free.empty())
+            fresh = new Page;
+        else
+        {
+            fresh = _free.back();
+            _free.pop_back();
+        }
+        memset(fresh, 0, sizeof(Page));
+        _own[page] = fresh;
+        _rpage[page] = fresh;
+        _present.push_back(page);
+    }
+    _wpage[page] = _own[page];
+    _dirty.push_back(page);
+    return _own[page];
 }
 
-void Simulator::runJalr(mc_t mc)
+void Simulator::releasePages()
 {
-    mc_t regA = (mc >> 19) & 0x7;
-    mc_t regB = (mc >> 16) & 0x7;
+    for (size_t i = 0; i < _present.size(); ++i)
+    {
+        int page = _present[i];
+        _free.push_back(_own[page]);
+        _own[page] = NULL;
+        _wpage[page] = NULL;
+        _rpage[page] = &ZERO_PAGE;
+    }
+    _present.clear();
+    _dirty.clear();
+}
+
+void Simulator::poke(int addr, word_t value)
+{
+    storeWord(addr, value);
+}
+
+void Simulator::clearDirty()
+{
+    for (size_t i = 0; i < _dirty.size(); ++i)
+        _wpage[_dirty[i]] = NULL;
+    _dirty.clear();
+}
+
+void Simulator::runBeq(const Decoded & ins)
+{
+    if (_reg[ins.regA] == _reg[ins.regB])
+        _pc += ins.offset;
+    ++_pc;
+}
 
-    _reg[regB] = _pc + 1;
-    _pc = _reg[regA];
+void Simulator::runJalr(const Decoded & ins)
+{
+    _reg[ins.regB] = _pc + 1;
+    _pc = _reg[ins.regA];
 }
 
-void Simulator::runHalt(mc_t mc)
+void Simulator::runHalt(const Decoded & ins)
 {
     _ready = false;
     _end = true;
 }
 
-void Simulator::runNoop(mc_t mc)
+void Simulator::runNoop(const Decoded & ins)
 {
     ++_pc;
 }
@@ -137,15 +154,14 @@ void Simulator::runNoop(mc_t mc)
 
 bool Simulator::next()
 {
-    if (_pc >= NUMMEMORY)
+    if ((unsigned)_pc >= (unsigned)NUMMEMORY)
         throw runtime_error("Invalid memory access!");
 
     if (_end || !_ready)
         return false;
 
-    mc_t cur = _mem[_pc]; 
-    mc_t opcode = (cur >> 22) & (0x7);
-    switch (opcode)
+    const Decoded & cur = fetch(_pc);
+    switch (cur.opcode)
     {
         case 0: runAdd(cur); break;
         case 1: runNand(cur); break;
@@ -159,26 +175,1041 @@ bool Simulator::next()
     return true;
 }
 
+long long Simulator::run(long long budget)
+{
+    // the engines set _retired themselves before throwing
+    _retired = 0;
+    if (_engine == THREADED)
+        return _retired = runThreaded(budget);
+    if (_engine == SUPERBLOCK)
+        return _retired = runSuperblock(budget);
+    if (_engine == JIT)
+        return _retired = runJit(budget);
+
+    long long count = 0;
+    try
+    {
+        while ((budget < 0 || count < budget) && next())
+            ++count;
+    }
+    catch (runtime_error &)
+    {
+        _retired = count;
+        throw;
+    }
+    return _retired = count;
+}
+
+// Direct-threaded interpreter: every handler ends with its own copy of the
+// dispatch, so the host branch predictor sees one indirect jump per opcode
+// instead of the single shared switch in next(). Compilers without
+// labels-as-values get the same handlers inside a switch loop.
+#if defined(__GNUC__)
+#define LC2K_CASE(code, name) do_##name:
+#define LC2K_DISPATCH() \
+    do { \
+        if (!left) goto out; \
+        if ((unsigned)pc >= (unsigned)NUMMEMORY) goto bad_pc; \
+        ins = &rpage[pc >> PAGE_BITS]->dec[pc & PAGE_MASK]; \
+        --left; \
+        goto *table[ins->opcode]; \
+    } while (0)
+#else
+#define LC2K_CASE(code, name) case code:
+#define LC2K_DISPATCH() continue
+#endif
+
+long long Simulator::runThreaded(long long budget)
+{
+    if (_end || !_ready)
+        return 0;
+
+    const long long total = budget < 0 ? LLONG_MAX : budget;
+    long long left = total;
+    word_t * const reg = _reg;
+    const Page * const * const rpage = _rpage;
+    const Decoded * ins;
+    int pc = _pc;
+
+#if defined(__GNUC__)
+    static void * const table[8] = {&&do_add, &&do_nand, &&do_lw, &&do_sw,
+                                    &&do_beq, &&do_jalr, &&do_halt, &&do_noop};
+    LC2K_DISPATCH();
+#else
+    for (;;)
+    {
+        if (!left) goto out;
+        if ((unsigned)pc >= (unsigned)NUMMEMORY) goto bad_pc;
+        ins = &rpage[pc >> PAGE_BITS]->dec[pc & PAGE_MASK];
+        --left;
+        switch (ins->opcode)
+        {
+#endif
+    LC2K_CASE(0, add)
+        reg[ins->destReg] = reg[ins->regA] + reg[ins->regB];
+        ++pc;
+        LC2K_DISPATCH();
+
+    LC2K_CASE(1, nand)
+        reg[ins->destReg] = ~(reg[ins->regA] & reg[ins->regB]);
+        ++pc;
+        LC2K_DISPATCH();
+
+    LC2K_CASE(2, lw)
+    {
+        int addr = reg[ins->regA] + ins->offset;
+        if (addr < 0 || addr >= NUMMEMORY)
+            goto bad_addr;
+        reg[ins->regB] = rpage[addr >> PAGE_BITS]->word[addr & PAGE_MASK];
+        ++pc;
+        LC2K_DISPATCH();
+    }
+
+    LC2K_CASE(3, sw)
+    {
+        int addr = reg[ins->regA] + ins->offset;
+        if (addr < 0 || addr >= NUMMEMORY)
+            goto bad_addr;
+        storeWord(addr, reg[ins->regB]);
+        ++pc;
+        LC2K_DISPATCH();
+    }
+
+    LC2K_CASE(4, beq)
+        if (reg[ins->regA] == reg[ins->regB])
+            pc += ins->offset;
+        ++pc;
+        LC2K_DISPATCH();
+
+    LC2K_CASE(5, jalr)
+        reg[ins->regB] = pc + 1;
+        pc = reg[ins->regA];
+        LC2K_DISPATCH();
+
+    LC2K_CASE(6, halt)
+        _ready = false;
+        _end = true;
+        goto out;
+
+    LC2K_CASE(7, noop)
+        ++pc;
+        LC2K_DISPATCH();
+#if !defined(__GNUC__)
+        }
+    }
+#endif
+
+out:
+    _pc = pc;
+    return total - left;
+
+bad_addr:
+    // dispatch already counted the faulting instruction
+    ++left;
+bad_pc:
+    _pc = pc;
+    _retired = total - left;
+    throw runtime_error("Invalid memory access!");
+}
+
+#undef LC2K_CASE
+#undef LC2K_DISPATCH
+
+void Simulator::translate(int start)
+{
+    Block blk;
+    int pc = start, done = 0;
+    while (done < MAX_BLOCK && pc < NUMMEMORY)
+    {
+        const Decoded & ins = fetch(pc);
+        const Decoded * follow = pc + 1 < NUMMEMORY ? &fetch(pc + 1) : NULL;
+        SuperOp op = SuperOp();
+        op.regA = ins.regA;
+        op.regB = ins.regB;
+        op.destReg = ins.destReg;
+        op.offset = ins.offset;
+        op.pc = pc;
+        op.done = done;
+
+        int width = 1;
+        bool terminal = false;
+        switch (ins.opcode)
+        {
+            case 0:
+            case 1:
+                op.kind = ins.opcode == 0 ? SB_ADD : SB_NAND;
+                if (follow && follow->opcode == 4 && follow->regA != follow->regB)
+                {
+                    op.kind = ins.opcode == 0 ? SB_ADD_BEQ : SB_NAND_BEQ;
+                    op.regA2 = follow->regA;
+                    op.regB2 = follow->regB;
+                    op.target = pc + 2 + follow->offset;
+                    width = 2;
+                }
+                break;
+            case 2:
+                op.kind = SB_LW;
+                if (follow && follow->opcode == 0)
+                {
+                    op.kind = SB_LW_ADD;
+                    op.regA2 = follow->regA;
+                    op.regB2 = follow->regB;
+                    op.destReg2 = follow->destReg;
+                    width = 2;
+                }
+                break;
+            case 3:
+                op.kind = SB_SW;
+                break;
+            case 4:
+                op.target = pc + 1 + ins.offset;
+                if (ins.regA == ins.regB)
+                {
+                    op.kind = SB_JUMP;
+                    terminal = true;
+                }
+                else
+                    op.kind = SB_BEQ;
+                break;
+            case 5:
+                op.kind = SB_JALR;
+                terminal = true;
+                break;
+            case 6:
+                // halt stays with the interpreter
+                terminal = true;
+                width = 0;
+                break;
+            case 7:
+                // noop only advances pc and the retired count
+                width = -1;
+                break;
+        }
+        if (width > 0)
+            blk.ops.push_back(op);
+        else if (width < 0)
+            width = 1;
+        for (int i = 0; i < width; ++i)
+            _code[pc + i] = 1;
+        pc += width;
+        done += width;
+        if (terminal)
+            break;
+    }
+    if (blk.ops.empty())
+        return;
+    blk.len = done;
+    blk.exit_pc = pc;
+    SuperOp end = SuperOp();
+    end.kind = SB_END;
+    blk.ops.push_back(end);
+    _block_at[start] = _blocks.size();
+    _blocks.push_back(blk);
+}
+
+void Simulator::initTiers()
+{
+    if (!_code.empty())
+        return;
+    _block_at.assign(NUMMEMORY, -1);
+    _jit_at.assign(NUMMEMORY, -1);
+    _heat.assign(NUMMEMORY, 0);
+    _code.assign(NUMMEMORY, 0);
+}
+
+// Drops all translated code, superblock and native alike.
+void Simulator::flushBlocks()
+{
+    for (size_t i = 0; i < _blocks.size(); ++i)
+        _block_at[_blocks[i].ops[0].pc] = -1;
+    _blocks.clear();
+    for (size_t i = 0; i < _jit_blocks.size(); ++i)
+        _jit_at[_jit_blocks[i].pc] = -1;
+    _jit_blocks.clear();
+    _jit_used = 0;
+    fill(_heat.begin(), _heat.end(), 0);
+    fill(_code.begin(), _code.end(), 0);
+}
+
+// Runs translated code from block `idx`, chaining straight into the block
+// at each exit address while there is one that fits in `left` instructions.
+// Returns the number of instructions retired. On an invalid memory access
+// it stops in front of the faulting instruction and leaves it to next().
+#if defined(__GNUC__)
+#define SB_CASE(kind) kind##_op:
+#define SB_DISPATCH() goto *table[op->kind]
+#define SB_NEXT() { ++op; SB_DISPATCH(); }
+#else
+#define SB_CASE(kind) case kind:
+#define SB_DISPATCH() goto dispatch
+#define SB_NEXT() { ++op; continue; }
+#endif
+
+long long Simulator::runBlocks(int idx, long long left, BlockExit & exit)
+{
+    word_t * const reg = _reg;
+    const Block * blk = &_blocks[idx];
+    const SuperOp * op = &blk->ops[0];
+    long long retired = 0;
+    int addr, done;
+
+#if defined(__GNUC__)
+    static void * const table[] = {&&SB_ADD_op, &&SB_NAND_op, &&SB_LW_op,
+                                   &&SB_SW_op, &&SB_BEQ_op, &&SB_JUMP_op,
+                                   &&SB_JALR_op, &&SB_LW_ADD_op,
+                                   &&SB_ADD_BEQ_op, &&SB_NAND_BEQ_op,
+                                   &&SB_END_op};
+    SB_DISPATCH();
+#else
+dispatch:
+    for (;;)
+        switch (op->kind)
+        {
+#endif
+    SB_CASE(SB_ADD)
+        reg[op->destReg] = reg[op->regA] + reg[op->regB];
+        SB_NEXT()
+    SB_CASE(SB_NAND)
+        reg[op->destReg] = ~(reg[op->regA] & reg[op->regB]);
+        SB_NEXT()
+    SB_CASE(SB_LW)
+        addr = reg[op->regA] + op->offset;
+        if (addr < 0 || addr >= NUMMEMORY)
+            goto fault;
+        reg[op->regB] = load(addr);
+        SB_NEXT()
+    SB_CASE(SB_LW_ADD)
+        addr = reg[op->regA] + op->offset;
+        if (addr < 0 || addr >= NUMMEMORY)
+            goto fault;
+        reg[op->regB] = load(addr);
+        reg[op->destReg2] = reg[op->regA2] + reg[op->regB2];
+        SB_NEXT()
+    SB_CASE(SB_SW)
+        addr = reg[op->regA] + op->offset;
+        if (addr < 0 || addr >= NUMMEMORY)
+            goto fault;
+        if (_code[addr])
+        {
+            // the store rewrites translated code: finish it and leave
+            // before the flush frees this block
+            _pc = op->pc + 1;
+            retired += op->done + 1;
+            exit = EXIT_END;
+            storeWord(addr, reg[op->regB]);
+            return retired;
+        }
+        storeWord(addr, reg[op->regB]);
+        SB_NEXT()
+    SB_CASE(SB_BEQ)
+        if (reg[op->regA] == reg[op->regB])
+        {
+            done = op->done + 1;
+            goto branch;
+        }
+        SB_NEXT()
+    SB_CASE(SB_JUMP)
+        done = op->done + 1;
+        goto branch;
+    SB_CASE(SB_JALR)
+        reg[op->regB] = op->pc + 1;
+        _pc = reg[op->regA];
+        retired += op->done + 1;
+        left -= op->done + 1;
+        exit = EXIT_BRANCH;
+        goto chain;
+    SB_CASE(SB_ADD_BEQ)
+        reg[op->destReg] = reg[op->regA] + reg[op->regB];
+        if (reg[op->regA2] == reg[op->regB2])
+        {
+            done = op->done + 2;
+            goto branch;
+        }
+        SB_NEXT()
+    SB_CASE(SB_NAND_BEQ)
+        reg[op->destReg] = ~(reg[op->regA] & reg[op->regB]);
+        if (reg[op->regA2] == reg[op->regB2])
+        {
+            done = op->done + 2;
+            goto branch;
+        }
+        SB_NEXT()
+    SB_CASE(SB_END)
+        _pc = blk->exit_pc;
+        retired += blk->len;
+        left -= blk->len;
+        exit = EXIT_END;
+        goto chain;
+#if !defined(__GNUC__)
+        }
+#endif
+
+branch:
+    _pc = op->target;
+    retired += done;
+    left -= done;
+    exit = EXIT_BRANCH;
+chain:
+    if ((unsigned)_pc < (unsigned)NUMMEMORY && (idx = _block_at[_pc]) >= 0
+        && _blocks[idx].len <= left)
+    {
+        blk = &_blocks[idx];
+        op = &blk->ops[0];
+        SB_DISPATCH();
+    }
+    return retired;
+
+fault:
+    _pc = op->pc;
+    retired += op->done;
+    exit = EXIT_FAULT;
+    return retired;
+}
+
+#undef SB_CASE
+#undef SB_DISPATCH
+#undef SB_NEXT
+
+// Executes one instruction through next() for the translating tiers and
+// records whether it transferred control, which is what makes its target a
+// block entry candidate.
+bool Simulator::stepProfiled(bool & branched)
+{
+    int opcode = (unsigned)_pc < (unsigned)NUMMEMORY ? fetch(_pc).opcode : 0;
+    int pc = _pc;
+    if (!next())
+        return false;
+    branched = opcode == 5 || (opcode == 4 && _pc != pc + 1);
+    return true;
+}
+
+long long Simulator::runSuperblock(long long budget)
+{
+    initTiers();
+
+    long long count = 0;
+    bool branched = true;
+    while ((budget < 0 || count < budget) && _ready && !_end)
+    {
+        if ((unsigned)_pc < (unsigned)NUMMEMORY)
+        {
+            int idx = _block_at[_pc];
+            if (idx < 0 && branched && ++_heat[_pc] >= HOT_THRESHOLD)
+            {
+                translate(_pc);
+                idx = _block_at[_pc];
+            }
+            long long left = budget < 0 ? LLONG_MAX : budget - count;
+            if (idx >= 0 && _blocks[idx].len <= left)
+            {
+                BlockExit exit;
+                count += runBlocks(idx, left, exit);
+                branched = exit == EXIT_BRANCH;
+                if (exit != EXIT_FAULT)
+                    continue;
+                // fall through: next() reports the invalid access
+            }
+        }
+
+        // side exits and cold code take the reference path; a fault
+        // there leaves run() with the count so far
+        _retired = count;
+        if (!stepProfiled(branched))
+            break;
+        ++count;
+    }
+    return count;
+}
+
+#ifdef LC2K_JIT
+// Just enough of an x86-64 encoder for the JIT. Methods taking an LC-2K
+// register number address the host register it is pinned to (r8d + r);
+// eax, ecx and ebp are scratch, rdi/rsi/rdx/rbx hold the register file,
+// read page table, code map and write page table.
+class X86Emitter
+{
+ public:
+    explicit X86Emitter(unsigned char * p): _p(p) {}
+    unsigned char * pos() const { return _p; }
+
+    void byte(int b) { *_p++ = (unsigned char)b; }
+    void bytes(const char * s, int n) { memcpy(_p, s, n); _p += n; }
+    void dword(int d) { memcpy(_p, &d, 4); _p += 4; }
+    void qword(unsigned long long q) { memcpy(_p, &q, 8); _p += 8; }
+
+    void loadReg(int r) { byte(0x44); byte(0x8B); byte(0x47 | r << 3); byte(r * 4); }
+    void saveReg(int r) { byte(0x44); byte(0x89); byte(0x47 | r << 3); byte(r * 4); }
+    void movEaxReg(int r) { byte(0x44); byte(0x89); byte(0xC0 | r << 3); }
+    void movRegEax(int r) { byte(0x41); byte(0x89); byte(0xC0 | r); }
+    void addEaxReg(int r) { byte(0x44); byte(0x01); byte(0xC0 | r << 3); }
+    void andEaxReg(int r) { byte(0x44); byte(0x21); byte(0xC0 | r << 3); }
+    void notEax() { byte(0xF7); byte(0xD0); }
+    void addEaxImm(int v) { byte(0x05); dword(v); }
+    void cmpEaxImm(int v) { byte(0x3D); dword(v); }
+    void cmpRegReg(int a, int b) { byte(0x45); byte(0x39); byte(0xC0 | b << 3 | a); }
+    void movRegImm(int r, int v) { byte(0x41); byte(0xB8 | r); dword(v); }
+    // r <- [rcx + rax*4], [rcx] <- r
+    void loadWord(int r) { byte(0x44); byte(0x8B); byte(0x04 | r << 3); byte(0x81); }
+    void storeWord(int r) { byte(0x44); byte(0x89); byte(0x01 | r << 3); }
+    void movRaxImm(unsigned long long q) { byte(0x48); byte(0xB8); qword(q); }
+    void movRcxImm(unsigned long long q) { byte(0x48); byte(0xB9); qword(q); }
+    void orRaxRcx() { byte(0x48); byte(0x09); byte(0xC8); }
+    void jmp(const unsigned char * to) { byte(0xE9); dword(int(to - (_p + 4))); }
+
+    // Short forward conditional jump, resolved by land().
+    enum { JAE = 0x3, JE = 0x4, JNE = 0x5 };
+    void exitIf(int cc, unsigned long long result, const unsigned char * epilogue)
+    {
+        unsigned char * skip = jccShort(cc ^ 1);
+        movRaxImm(result);
+        jmp(epilogue);
+        land(skip);
+    }
+    unsigned char * jccShort(int cc) { byte(0x70 | cc); byte(0); return _p; }
+    void land(unsigned char * from) { from[-1] = (unsigned char)(_p - from); }
+
+ private:
+    unsigned char * _p;
+};
+
+// Page lookups for the address in eax: rcx <- page pointer from the read
+// or write table, eax <- index within the page.
+static const char READ_PAGE[] =
+    "\x89\xC1"                    // mov ecx, eax
+    "\xC1\xE9\x08"                // shr ecx, 8
+    "\x48\x8B\x0C\xCE"            // mov rcx, [rsi+rcx*8]
+    "\x25\xFF\x00\x00\x00";       // and eax, 255
+static const char WRITE_PAGE[] =
+    "\x89\xC1"                    // mov ecx, eax
+    "\xC1\xE9\x08"                // shr ecx, 8
+    "\x48\x8B\x0C\xCB"            // mov rcx, [rbx+rcx*8]
+    "\x48\x85\xC9";               // test rcx, rcx
+
+// With rcx = page and eax = index: point rcx at the word, and after the
+// store rebuild its Decoded record at rcx + rax*4 + 1024 byte by byte.
+static const char WORD_ADDR[] =
+    "\x25\xFF\x00\x00\x00"       // and eax, 255
+    "\x48\x8D\x0C\x81";           // lea rcx, [rcx+rax*4]
+static const char REDECODE[] =
+    "\x8B\x29\xC1\xED\x16\x83\xE5\x07"               // ebp = [rcx] >> 22 & 7
+    "\x40\x88\xAC\x81\x00\x04\x00\x00"               // opcode
+    "\x8B\x29\xC1\xED\x13\x83\xE5\x07"               // ebp = [rcx] >> 19 & 7
+    "\x40\x88\xAC\x81\x01\x04\x00\x00"               // regA
+    "\x8B\x29\xC1\xED\x10\x83\xE5\x07"               // ebp = [rcx] >> 16 & 7
+    "\x40\x88\xAC\x81\x02\x04\x00\x00"               // regB
+    "\x8B\x29\x83\xE5\x07"                           // ebp = [rcx] & 7
+    "\x40\x88\xAC\x81\x03\x04\x00\x00"               // destReg
+    "\x0F\xBF\x29"                                   // movsx ebp, word [rcx]
+    "\x89\xAC\x81\x04\x04\x00\x00";                  // offset
+
+static unsigned long long jitResult(int pc, int retired, int exit)
+{
+    return (unsigned)pc | (unsigned long long)retired << 32
+                        | (unsigned long long)exit << 48;
+}
+
+void Simulator::jitTranslate(int start)
+{
+    static_assert(sizeof(Decoded) == 8 && offsetof(Page, dec) == 4 * PAGE_SIZE,
+                  "REDECODE assumes this page layout");
+    // a store: address and bounds check, code map check, page lookup and
+    // check, the store and its redecode, three exits of jcc, mov and jmp
+    static_assert(3 + 5 + 5 + 4 + sizeof(WRITE_PAGE) - 1 + sizeof(WORD_ADDR) - 1 + 3
+                  + sizeof(REDECODE) - 1 + 3 * (2 + 10 + 5) <= JIT_MAX_OP_BYTES,
+                  "a store can outgrow JIT_MAX_OP_BYTES");
+    if (JIT_BUFFER - _jit_used < JIT_MAX_BLOCK_BYTES)
+        flushBlocks();
+    if (mprotect(_jit_buf, JIT_BUFFER, PROT_READ | PROT_WRITE))
+        throw runtime_error("JIT: mprotect failed");
+
+    // the buffer starts with the exit sequence shared by all blocks
+    X86Emitter e(_jit_buf + _jit_used);
+    const unsigned char * epilogue = _jit_buf;
+    if (_jit_used == 0)
+    {
+        for (int r = 0; r < NUMREGS; ++r)
+            e.saveReg(r);
+        e.bytes("\x41\x5F\x41\x5E\x41\x5D\x41\x5C\x5D\x5B\xC3", 11);
+    }
+
+    unsigned char * entry = e.pos();
+    // push rbx, rbp, r12-r15; mov rbx, rcx
+    e.bytes("\x53\x55\x41\x54\x41\x55\x41\x56\x41\x57\x48\x89\xCB", 13);
+    for (int r = 0; r < NUMREGS; ++r)
+        e.loadReg(r);
+
+    int pc = start, done = 0;
+    bool terminal = false, open = true;
+    while (!terminal && done < MAX_BLOCK && pc < NUMMEMORY)
+    {
+        const Decoded & ins = fetch(pc);
+        switch (ins.opcode)
+        {
+            case 0:
+                e.movEaxReg(ins.regA);
+                e.addEaxReg(ins.regB);
+                e.movRegEax(ins.destReg);
+                break;
+            case 1:
+                e.movEaxReg(ins.regA);
+                e.andEaxReg(ins.regB);
+                e.notEax();
+                e.movRegEax(ins.destReg);
+                break;
+            case 2:
+            case 3:
+                e.movEaxReg(ins.regA);
+                e.addEaxImm(ins.offset);
+                e.cmpEaxImm(NUMMEMORY);
+                e.exitIf(X86Emitter::JAE, jitResult(pc, done, JIT_INTERP), epilogue);
+                if (ins.opcode == 2)
+                {
+                    e.bytes(READ_PAGE, sizeof(READ_PAGE) - 1);
+                    e.loadWord(ins.regB);
+                    break;
+                }
+                // cmp byte [rdx+rax], 0
+                e.bytes("\x80\x3C\x02\x00", 4);
+                e.exitIf(X86Emitter::JNE, jitResult(pc, done, JIT_INTERP), epilogue);
+                e.bytes(WRITE_PAGE, sizeof(WRITE_PAGE) - 1);
+                e.exitIf(X86Emitter::JE, jitResult(pc, done, JIT_INTERP), epilogue);
+                e.bytes(WORD_ADDR, sizeof(WORD_ADDR) - 1);
+                e.storeWord(ins.regB);
+                e.bytes(REDECODE, sizeof(REDECODE) - 1);
+                break;
+            case 4:
+                if (ins.regA == ins.regB)
+                {
+                    e.movRaxImm(jitResult(pc + 1 + ins.offset, done + 1, JIT_BRANCH));
+                    e.jmp(epilogue);
+                    terminal = true;
+                    open = false;
+                    break;
+                }
+                e.cmpRegReg(ins.regA, ins.regB);
+                e.exitIf(X86Emitter::JE, jitResult(pc + 1 + ins.offset, done + 1, JIT_BRANCH),
+                         epilogue);
+                break;
+            case 5:
+                e.movRegImm(ins.regB, pc + 1);
+                e.movEaxReg(ins.regA);
+                e.movRcxImm(jitResult(0, done + 1, JIT_BRANCH));
+                e.orRaxRcx();
+                e.jmp(epilogue);
+                terminal = true;
+                open = false;
+                break;
+            case 6:
+                // halt stays with the interpreter
+                terminal = true;
+                continue;
+            case 7:
+                break;
+        }
+        _code[pc] = 1;
+        ++pc;
+        ++done;
+    }
+    if (done == 0)
+    {
+        mprotect(_jit_buf, JIT_BUFFER, PROT_READ | PROT_EXEC);
+        return;
+    }
+    if (open)
+    {
+        e.movRaxImm(jitResult(pc, done, JIT_END));
+        e.jmp(epilogue);
+    }
+    _jit_used = e.pos() - _jit_buf;
+    if (mprotect(_jit_buf, JIT_BUFFER, PROT_READ | PROT_EXEC))
+        throw runtime_error("JIT: mprotect failed");
+
+    JitBlock blk;
+    blk.fn = (JitFn)entry;
+    blk.pc = start;
+    blk.len = done;
+    _jit_at[start] = _jit_blocks.size();
+    _jit_blocks.push_back(blk);
+}
+#endif
+
+long long Simulator::runJit(long long budget)
+{
+#ifdef LC2K_JIT
+    if (!_jit_buf)
+    {
+        void * buf = mmap(NULL, JIT_BUFFER, PROT_READ | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED)
+            return runThreaded(budget);
+        _jit_buf = (unsigned char *)buf;
+    }
+    initTiers();
+
+    long long count = 0;
+    bool branched = true;
+    while ((budget < 0 || count < budget) && _ready && !_end)
+    {
+        if ((unsigned)_pc < (unsigned)NUMMEMORY)
+        {
+            int idx = _jit_at[_pc];
+            if (idx < 0 && branched && ++_heat[_pc] >= HOT_THRESHOLD)
+            {
+                jitTranslate(_pc);
+                idx = _jit_at[_pc];
+            }
+            if (idx >= 0 && (budget < 0 || budget - count >= _jit_blocks[idx].len))
+            {
+                unsigned long long r = _jit_blocks[idx].fn(_reg, _rpage, &_code[0], _wpage);
+                _pc = (int)(unsigned)r;
+                count += (r >> 32) & 0xffff;
+                int exit = r >> 48;
+                branched = exit == JIT_BRANCH;
+                if (exit != JIT_INTERP)
+                    continue;
+            }
+        }
+
+        _retired = count;
+        if (!stepProfiled(branched))
+            break;
+        ++count;
+    }
+    return count;
+#else
+    // no native backend for this host
+    return runThreaded(budget);
+#endif
+}
+
+bool Simulator::parseEngine(const string & name, Engine & engine)
+{
+    static const char * const names[] = {"switch", "threaded", "superblock", "jit"};
+    for (int i = 0; i < 4; ++i)
+        if (name == names[i])
+        {
+            engine = Engine(i);
+            return true;
+        }
+    return false;
+}
+
+Simulator::Simulator(): _ready(false), _jit_buf(NULL), _jit_used(0), _engine(SWITCH), _retired(0)
+{
+    for (int i = 0; i < NUMPAGES; ++i)
+    {
+        _rpage[i] = &ZERO_PAGE;
+        _wpage[i] = NULL;
+        _own[i] = NULL;
+    }
+}
+
+Simulator::~Simulator()
+{
+    releasePages();
+    for (size_t i = 0; i < _free.size(); ++i)
+        delete _free[i];
+#ifdef LC2K_JIT
+    if (_jit_buf)
+        munmap(_jit_buf, JIT_BUFFER);
+#endif
+}
+
+bool Simulator::next(Delta & delta)
+{
+    delta.reg = -1;
+    delta.addr = -1;
+    if ((unsigned)_pc < (unsigned)NUMMEMORY && _ready && !_end)
+    {
+        const Decoded & cur = fetch(_pc);
+        switch (cur.opcode)
+        {
+            case 0: case 1: delta.reg = cur.destReg; break;
+            case 2: case 5: delta.reg = cur.regB; break;
+            case 3: delta.addr = _reg[cur.regA] + cur.offset; break;
+        }
+    }
+    if (!next())
+        return false;
+    delta.pc = _pc;
+    if (delta.reg >= 0)
+        delta.regValue = _reg[delta.reg];
+    if (delta.addr >= 0)
+        delta.memValue = load(delta.addr);
+    return true;
+}
+
 void Simulator::setMC(const vector<mc_t> & mc)
+{
+    beginLoad(mc.size());
+    for (int i = 0; i < _mem_c; ++i)
+        if (mc[i])
+            storeWord(i, mc[i]);
+    endLoad();
+}
+
+// For machine code that is already in memory, e.g. Assembler::get_code().
+void Simulator::setMC(const word_t * words, int count)
+{
+    beginLoad(count);
+    for (int i = 0; i < _mem_c; ++i)
+        if (words[i])
+            storeWord(i, words[i]);
+    endLoad();
+}
+
+// Words go straight from the object file into memory pages.
+void Simulator::setObject(const void * data, size_t size, const string & filename)
+{
+    ObjImage obj;
+    switch (obj_parse(data, size, &obj))
+    {
+        case 0: break;
+        case -2: throw runtime_error("Unsupported object version: " + filename);
+        default: throw runtime_error("Corrupt object file: " + filename);
+    }
+    if (obj.words > (unsigned)NUMMEMORY)
+        throw runtime_error("Program too large: " + filename);
+    beginLoad(obj.words);
+    for (int i = 0; i < _mem_c; ++i)
+        if (word_t w = obj_word(&obj, i))
+            storeWord(i, w);
+    endLoad();
+}
+
+void Simulator::beginLoad(int words)
 {
     if (_ready)
         throw runtime_error("The code is executing!");
 
     memset(_reg, 0, sizeof(word_t)*NUMREGS);
-    memset(_mem, 0, sizeof(word_t)*NUMMEMORY);
+    releasePages();
 
-    _mem_c = mc.size();
-    copy(mc.begin(), mc.end(), _mem);
+    if (!_code.empty())
+        flushBlocks();
+
+    _mem_c = words;
+}
+
+void Simulator::endLoad()
+{
     _pc = 0;
     _ready = true;
     _end = false;
 }
 
+unsigned long long Simulator::stateHash() const
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    const int n = NUMREGS + 1 + _mem_c;
+    for (int i = 0; i < n; ++i)
+    {
+        word_t w = i == 0 ? _pc : i <= NUMREGS ? _reg[i - 1] : load(i - 1 - NUMREGS);
+        for (int b = 0; b < 4; ++b)
+        {
+            hash ^= (w >> (8 * b)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+// Snapshot file, all integers little-endian:
+//
+//   "LCSN", u32 version, i32 pc, u8 ready, u8 end, u16 pages, i32 mem_c,
+//   i32 reg[8], i64 executed, pages x (u32 page, i32 word[256]),
+//   u32 FNV-1a of everything before it
+static const char SNAPSHOT_MAGIC[4] = {'L', 'C', 'S', 'N'};
+static const unsigned SNAPSHOT_VERSION = 1;
+static const size_t SNAPSHOT_HEADER = 4 + 4 + 4 + 4 + 4 + 4 * 8 + 8;
+
+static inline void putLE32(unsigned char *& p, unsigned v)
+{
+    lc2k_put32(p, v);
+    p += 4;
+}
+
+static inline unsigned getLE32(const unsigned char *& p)
+{
+    p += 4;
+    return lc2k_get32(p - 4);
+}
+
+// A file of known size that is filled in place through a shared mapping,
+// written to a temporary name and renamed over the target by commit().
+// Hosts without mmap fill a buffer and write it out instead.
+class MappedOutput
+{
+ public:
+    MappedOutput(const string & filename, size_t size);
+    ~MappedOutput();
+    unsigned char * data() { return _data; }
+    void commit();
+
+ private:
+    string _name, _tmp;
+    size_t _size;
+    unsigned char * _data;
+#ifdef LC2K_MMAP
+    int _fd;
+#else
+    vector<unsigned char> _buf;
+#endif
+};
+
+MappedOutput::MappedOutput(const string & filename, size_t size):
+    _name(filename), _tmp(filename + ".tmp"), _size(size), _data(NULL)
+{
+#ifdef LC2K_MMAP
+    _fd = open(_tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0)
+        throw runtime_error("Invalid filename: " + _tmp);
+    void * map = MAP_FAILED;
+    if (ftruncate(_fd, _size) == 0)
+        map = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(_fd);
+        unlink(_tmp.c_str());
+        throw runtime_error("Cannot map " + _tmp);
+    }
+    _data = (unsigned char *)map;
+#else
+    _buf.resize(_size);
+    _data = &_buf[0];
+#endif
+}
+
+MappedOutput::~MappedOutput()
+{
+#ifdef LC2K_MMAP
+    if (_data)
+    {
+        munmap(_data, _size);
+        close(_fd);
+        unlink(_tmp.c_str());
+    }
+#endif
+}
+
+void MappedOutput::commit()
+{
+#ifdef LC2K_MMAP
+    munmap(_data, _size);
+    _data = NULL;
+    close(_fd);
+#else
+    ofstream ofs(_tmp.c_str(), ios::binary);
+    if (!ofs.write((const char *)_data, _size))
+        throw runtime_error("Cannot write " + _tmp);
+    ofs.close();
+    remove(_name.c_str());
+#endif
+    if (rename(_tmp.c_str(), _name.c_str()) != 0)
+        throw runtime_error("Cannot write " + _name);
+}
+
+void Simulator::saveSnapshot(const string & filename, long long executed) const
+{
+    int pages = 0;
+    for (int i = 0; i < NUMPAGES; ++i)
+        if (_own[i])
+            ++pages;
+    const size_t size = SNAPSHOT_HEADER + pages * (4 + 4 * PAGE_SIZE) + 4;
+
+    MappedOutput out(filename, size);
+    unsigned char * p = out.data();
+    memcpy(p, SNAPSHOT_MAGIC, 4);
+    p += 4;
+    putLE32(p, SNAPSHOT_VERSION);
+    putLE32(p, _pc);
+    putLE32(p, _ready | _end << 8 | pages << 16);
+    putLE32(p, _mem_c);
+    for (int r = 0; r < NUMREGS; ++r)
+        putLE32(p, _reg[r]);
+    putLE32(p, (unsigned)executed);
+    putLE32(p, (unsigned)(executed >> 32));
+    for (int i = 0; i < NUMPAGES; ++i)
+        if (_own[i])
+        {
+            putLE32(p, i);
+            for (int w = 0; w < PAGE_SIZE; ++w)
+                putLE32(p, _own[i]->word[w]);
+        }
+    putLE32(p, lc2k_fnv32(out.data(), size - 4));
+    out.commit();
+}
+
+long long Simulator::loadSnapshot(const string & filename)
+{
+    MapFile in;
+    if (mapfile_open(&in, filename.c_str()) != 0)
+        throw runtime_error("Invalid filename: " + filename);
+    long long executed;
+    try
+    {
+        executed = restoreSnapshot((const unsigned char *)in.data, in.size, filename);
+    }
+    catch (...)
+    {
+        mapfile_close(&in);
+        throw;
+    }
+    mapfile_close(&in);
+    return executed;
+}
+
+long long Simulator::restoreSnapshot(const unsigned char * p, size_t size,
+                                     const string & filename)
+{
+    if (size < SNAPSHOT_HEADER + 4 || memcmp(p, SNAPSHOT_MAGIC, 4) != 0)
+        throw runtime_error("Not a snapshot: " + filename);
+    const unsigned char * sum = p + size - 4;
+    if (getLE32(sum) != lc2k_fnv32(p, size - 4))
+        throw runtime_error("Corrupt snapshot: " + filename);
+    p += 4;
+    if (getLE32(p) != SNAPSHOT_VERSION)
+        throw runtime_error("Unsupported snapshot version: " + filename);
+    int pc = getLE32(p);
+    unsigned flags = getLE32(p);
+    int pages = flags >> 16;
+    int mem_c = getLE32(p);
+    if (pages > NUMPAGES || mem_c < 0 || mem_c > NUMMEMORY
+        || size != SNAPSHOT_HEADER + pages * (4 + 4 * PAGE_SIZE) + 4)
+        throw runtime_error("Corrupt snapshot: " + filename);
+
+    for (int r = 0; r < NUMREGS; ++r)
+        _reg[r] = getLE32(p);
+    long long executed = getLE32(p);
+    executed |= (long long)getLE32(p) << 32;
+
+    releasePages();
+    if (!_code.empty())
+        flushBlocks();
+    for (int i = 0; i < pages; ++i)
+    {
+        unsigned page = getLE32(p);
+        if (page >= (unsigned)NUMPAGES)
+            throw runtime_error("Corrupt snapshot: " + filename);
+        Page * dst = touchPage(page);
+        for (int w = 0; w < PAGE_SIZE; ++w)
+        {
+            dst->word[w] = getLE32(p);
+            dst->dec[w] = decode(dst->word[w]);
+        }
+    }
+    _pc = pc;
+    _mem_c = mem_c;
+    _ready = flags & 1;
+    _end = (flags >> 8) & 1;
+    return executed;
+}
+
 void Simulator::printInit(ostream & os)
 {
     for (int i = 0; i < _mem_c; ++i)
 //        printf("memory[%d] = %d\n", i, _mem[i]);
-        os << "memory[" << i << "]=" << _mem[i] << endl;
+        os << "memory[" << i << "]=" << load(i) << endl;
     os.flush();
 }
 
@@ -190,7 +1221,7 @@ void Simulator::printState(ostream & os)
        << "\tpc " << _pc << endl
        << "\tmemory: " << endl;
     for (int i = 0; i < _mem_c; ++i)
-        os << "\t\tmem[ " << i << " ] " << _mem[i] << endl;
+        os << "\t\tmem[ " << i << " ] " << load(i) << endl;
     os << "\tregisters:" << endl;
     for (int i = 0; i < NUMREGS; ++i)
         os << "\t\treg[ " << i << " ] " << _reg[i] << endl;
@@ -200,45 +1231,42 @@ void Simulator::printState(ostream & os)
 
 void Simulator::loadFromFile(string filename)
 {
-    ifstream ifs(filename.c_str());
-    if (!ifs)
+    MapFile file;
+    if (mapfile_open(&file, filename.c_str()) != 0)
         throw runtime_error("Invalid filename: "+filename);
 
+    if (obj_is_object(file.data, file.size))
+    {
+        try
+        {
+            setObject(file.data, file.size, filename);
+        }
+        catch (...)
+        {
+            mapfile_close(&file);
+            throw;
+        }
+        mapfile_close(&file);
+        return;
+    }
+
+    // like `ifs >> tmp`: stop quietly at the first thing that is not an int
     vector<mc_t> mc;
+    const char *p = file.data, *end = p + file.size;
     int tmp;
-    while (ifs >> tmp)
+    while ((p = mapfile_skip_space(p, end)) != end
+           && (p = mapfile_parse_int(p, end, &tmp)))
         mc.push_back(tmp);
+    mapfile_close(&file);
     setMC(mc);
 }
 
-int main(int argc, char *argv[])
+void Simulator::printSummary(long long count, bool halted, ostream & os)
 {
-    if (argc != 2)
-    {
-        std::cerr << "Usage: " << argv[0] << " <filename>" << endl;
-        return EXIT_FAILURE;
-    }
-
-    int count = 0;
-    Simulator simulator;
-    try
-    {
-        simulator.loadFromFile(argv[1]);
-        simulator.printInit();
-        simulator.printState();
-
-        while (simulator.next())
-        {
-            simulator.printState();
-            count++;
-        }
-        cout << "machine halted\ntotal of "<< count <<" instructions executed\nfinal state of machine:\n";
-        simulator.printState();
-    }
-    catch (runtime_error e)
-    {
-        cerr << e.what(); 
-        return EXIT_FAILURE;
-    }
-    return EXIT_SUCCESS;
+    if (halted)
+        os << "machine halted\n";
+    else
+        os << "instruction budget exhausted\n";
+    os << "total of "<< count <<" instructions executed\nfinal state of machine:\n";
+    printState(os);
 }
@@ -0,0 +1,299 @@
+// LC-2K functional simulator. The library is simulator.cpp; simulate.cpp
+// is the command-line front end.
+#ifndef LC2K_SIMULATOR_H
+#define LC2K_SIMULATOR_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstddef>
+
+class Simulator
+{
+ public:
+    typedef unsigned int mc_t;
+    typedef int word_t;
+
+    // Instruction fields extracted once per memory word, so that next()
+    // only has to execute. A zero word decodes to an all-zero record.
+    // The pipeline model shares the decoder.
+    struct Decoded
+    {
+        unsigned char opcode, regA, regB, destReg;
+        word_t offset;
+    };
+    static inline word_t getOffset(mc_t );
+    static inline Decoded decode(mc_t );
+
+ private:
+    static const int NUMMEMORY = 65536;
+    static const int NUMREGS = 8;
+
+    // Memory is a table of 256-word pages, each carrying the decoded form
+    // of its words. Pages never written map to one shared zero page, so
+    // setup cost follows the program size rather than NUMMEMORY. A page
+    // gets storage on its first write and stays dirty until clearDirty();
+    // _wpage only holds dirty pages, so every write to a clean page takes
+    // the slow path in touchPage() and gets recorded.
+    static const int PAGE_BITS = 8;
+    static const int PAGE_SIZE = 1 << PAGE_BITS;
+    static const int PAGE_MASK = PAGE_SIZE - 1;
+    static const int NUMPAGES = NUMMEMORY / PAGE_SIZE;
+    struct Page
+    {
+        word_t word[PAGE_SIZE];
+        Decoded dec[PAGE_SIZE];
+    };
+    static const Page ZERO_PAGE;
+
+    word_t _reg[NUMREGS];
+    const Page * _rpage[NUMPAGES];            // read view
+    Page * _wpage[NUMPAGES];                  // dirty pages, NULL otherwise
+    Page * _own[NUMPAGES];                    // allocated pages, NULL otherwise
+    std::vector<int> _present;                     // pages with storage
+    std::vector<int> _dirty;                       // pages written since clearDirty()
+    std::vector<Page *> _free;
+
+    inline word_t load(int addr) const
+    { return _rpage[addr >> PAGE_BITS]->word[addr & PAGE_MASK]; }
+    inline const Decoded & fetch(int addr) const
+    { return _rpage[addr >> PAGE_BITS]->dec[addr & PAGE_MASK]; }
+    Page * touchPage(int page);
+    void releasePages();
+    long long restoreSnapshot(const unsigned char *, size_t, const std::string &);
+    void beginLoad(int words);
+    void endLoad();
+
+    int _mem_c, _pc;
+    bool _ready;
+    bool _end;
+
+    inline void runAdd(const Decoded &);
+    inline void runNand(const Decoded &);
+    inline void runLw(const Decoded &);
+    inline void runSw(const Decoded &);
+    inline void runBeq(const Decoded &);
+    inline void runJalr(const Decoded &);
+    inline void runHalt(const Decoded &);
+    inline void runNoop(const Decoded &);
+
+    inline void storeWord(int addr, word_t value);
+
+    long long runThreaded(long long budget);
+
+    // Superblock tier. Targets of beq/jalr are profiled while interpreting;
+    // once a target gets hot, the straight-line code from there (continuing
+    // past not-taken branches) is translated into superinstructions that
+    // run in one dispatch each. Common pairs are fused and `beq r r` becomes
+    // a plain jump. Any taken branch leaves the block.
+    enum SuperKind { SB_ADD, SB_NAND, SB_LW, SB_SW, SB_BEQ, SB_JUMP, SB_JALR,
+                     SB_LW_ADD, SB_ADD_BEQ, SB_NAND_BEQ, SB_END };
+    enum BlockExit { EXIT_END, EXIT_BRANCH, EXIT_FAULT };
+    static const int HOT_THRESHOLD = 8;
+    static const int MAX_BLOCK = 64;
+
+    struct SuperOp
+    {
+        unsigned char kind;
+        unsigned char regA, regB, destReg;    // first instruction
+        unsigned char regA2, regB2, destReg2; // second instruction if fused
+        word_t offset;                        // lw/sw offset
+        int target;                           // taken branch target
+        int pc;                               // address of the first instruction
+        int done;                             // instructions retired before this op
+    };
+    struct Block
+    {
+        std::vector<SuperOp> ops;                  // terminated by an SB_END op
+        int len;                              // instructions on the fall-through path
+        int exit_pc;
+    };
+
+    std::vector<Block> _blocks;
+    std::vector<int> _block_at;                    // block index by entry pc, -1 if none
+    std::vector<unsigned short> _heat;             // arrivals by control transfer
+    std::vector<unsigned char> _code;              // addresses covered by some block
+
+    void initTiers();
+    void translate(int start);
+    void flushBlocks();
+    long long runBlocks(int idx, long long left, BlockExit & exit);
+    long long runSuperblock(long long budget);
+    inline bool stepProfiled(bool & branched);
+
+    // Native tier. Hot blocks found the same way as superblocks are
+    // compiled to x86-64 in an mmap'd buffer, with LC-2K registers pinned
+    // to r8d-r15d. A block returns the next pc, the number of instructions
+    // retired and a JitExit reason packed in one 64-bit value. JIT_INTERP
+    // leaves an instruction the native code cannot finish (invalid address,
+    // store to a clean page or into translated code) to next().
+    enum JitExit { JIT_BRANCH, JIT_END, JIT_INTERP };
+    typedef unsigned long long (*JitFn)(word_t * reg, const Page * const * rpage,
+                                        unsigned char * code, Page * const * wpage);
+    struct JitBlock
+    {
+        JitFn fn;
+        int pc;
+        int len;
+    };
+    static const size_t JIT_BUFFER = 1 << 22;
+    // Room a block may need: the longest instruction (a store, checked in
+    // jitTranslate()) MAX_BLOCK times, and the shared epilogue, the
+    // prologue and the closing exit, 103 bytes between them
+    static const size_t JIT_MAX_OP_BYTES = 168;
+    static const size_t JIT_MAX_BLOCK_BYTES = MAX_BLOCK * JIT_MAX_OP_BYTES + 128;
+
+    unsigned char * _jit_buf;
+    size_t _jit_used;
+    std::vector<JitBlock> _jit_blocks;
+    std::vector<int> _jit_at;                      // JIT block index by entry pc
+
+    void jitTranslate(int start);
+    long long runJit(long long budget);
+ public:
+    // Execution engines for run(). SWITCH steps through next(); THREADED
+    // dispatches a whole run inside one function with computed gotos;
+    // SUPERBLOCK interprets cold code and runs hot blocks as superinstructions;
+    // JIT runs hot blocks as native code (THREADED where that is unsupported).
+    enum Engine { SWITCH, THREADED, SUPERBLOCK, JIT };
+    // "switch", "threaded", "superblock" or "jit"; false for anything else
+    static bool parseEngine(const std::string & name, Engine & engine);
+
+    Simulator();
+    ~Simulator();
+    Simulator(const Simulator &) = delete;
+    Simulator & operator=(const Simulator &) = delete;
+
+    // Decimal machine code, or a binary object (common/objfile.h).
+    void loadFromFile(std::string filename);
+    void setMC(const std::vector<mc_t> &mc);
+    void setMC(const word_t * words, int count);
+    void setObject(const void * data, size_t size, const std::string & filename);
+    void printInit(std::ostream & os = std::cout);
+    void printState(std::ostream & os = std::cout);
+    bool next();
+
+    // What one step wrote, for delta traces. reg and addr are -1 when the
+    // step wrote no register or no memory word.
+    struct Delta
+    {
+        int pc;
+        int reg;
+        word_t regValue;
+        int addr;
+        word_t memValue;
+    };
+    bool next(Delta & delta);
+    // Run without tracing until halt or until `budget` instructions have been
+    // executed (a negative budget means no limit). Returns the number of
+    // instructions executed, counted the same way as the tracing loop.
+    long long run(long long budget = -1);
+    // The count of the last run(), also when it threw: the instructions
+    // executed before the faulting one
+    long long retired() const { return _retired; }
+    bool halted() const { return _end; }
+    // run() on the reference interpreter with every retired instruction
+    // reported to `observer`, which provides
+    //   void retire(int pc, int opcode)
+    //   void read(int addr), void write(int addr)     lw and sw
+    //   void branch(int pc, bool taken)                beq
+    //   void jump(int pc, int target)                  jalr
+    // The hooks are bound at compile time, so run() and the other engines
+    // carry no instrumentation at all.
+    template <class Observer>
+    long long runObserved(Observer & observer, long long budget = -1);
+    void setEngine(Engine engine) { _engine = engine; }
+    // Abandon the loaded program so that the next setMC() can start afresh.
+    void reset() { _ready = false; }
+    // Let a halted machine go on from its pc; the multi-hart scheduler
+    // switches register contexts over one memory image this way.
+    void resume() { if (_end) { _end = false; _ready = true; } }
+    // FNV-1a over pc, registers and the loaded memory image.
+    unsigned long long stateHash() const;
+    // The "machine halted"/"instruction budget exhausted" report that ends
+    // a run, followed by the final state.
+    void printSummary(long long count, bool halted, std::ostream & os = std::cout);
+
+    // Pages written since the last clearDirty() (setMC() counts as a
+    // write), for dumps and diffs that only need to visit changed memory.
+    static const int PAGE_WORDS = PAGE_SIZE;
+    static const int MEMORY_WORDS = NUMMEMORY;
+    const std::vector<int> & dirtyPages() const { return _dirty; }
+    const word_t * pageWords(int page) const { return _rpage[page]->word; }
+    void clearDirty();
+
+    // Direct state access for tools that rebuild or hand over machine state.
+    int pc() const { return _pc; }
+    int memSize() const { return _mem_c; }
+    word_t reg(int r) const { return _reg[r]; }
+    word_t peek(int addr) const { return load(addr); }
+    void setPC(int pc) { _pc = pc; }
+    void setReg(int r, word_t value) { _reg[r] = value; }
+    void poke(int addr, word_t value);
+
+    // Snapshot of pc, registers, run flags and every page with storage,
+    // together with the caller's instruction count. The file is written to
+    // "<filename>.tmp" and renamed into place, so a job killed mid-write
+    // still leaves the previous snapshot. loadSnapshot() replaces the whole
+    // machine state and returns the stored count.
+    void saveSnapshot(const std::string & filename, long long executed) const;
+    long long loadSnapshot(const std::string & filename);
+
+ private:
+    Engine _engine;
+    long long _retired;
+};
+
+Simulator::word_t Simulator::getOffset(mc_t mc)
+{
+    mc_t offset = mc & ((1 << 16) - 1);
+    if (offset & (1 << 15))
+        return int(offset - (1 << 16));
+    else
+        return offset;
+}
+
+Simulator::Decoded Simulator::decode(mc_t mc)
+{
+    Decoded ins;
+    ins.opcode = (mc >> 22) & 0x7;
+    ins.regA = (mc >> 19) & 0x7;
+    ins.regB = (mc >> 16) & 0x7;
+    ins.destReg = (mc >> 0) & 0x7;
+    ins.offset = getOffset(mc);
+    return ins;
+}
+
+template <class Observer>
+long long Simulator::runObserved(Observer & observer, long long budget)
+{
+    long long count = 0;
+    while (budget < 0 || count < budget)
+    {
+        // operands are read before next() since it may overwrite them
+        int pc = _pc, opcode = 0, addr = 0;
+        bool equal = false;
+        if ((unsigned)pc < (unsigned)NUMMEMORY)
+        {
+            const Decoded & cur = fetch(pc);
+            opcode = cur.opcode;
+            addr = _reg[cur.regA] + cur.offset;
+            equal = _reg[cur.regA] == _reg[cur.regB];
+        }
+        if (!next())
+            break;
+        ++count;
+
+        observer.retire(pc, opcode);
+        switch (opcode)
+        {
+            case 2: observer.read(addr); break;
+            case 3: observer.write(addr); break;
+            case 4: observer.branch(pc, equal); break;
+            case 5: observer.jump(pc, _pc); break;
+        }
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,5 @@
+        lw      0   1   far
+        add     1   1   2
+        jalr    1   3           jumps past the end of memory
+        halt
+far     .fill   70000
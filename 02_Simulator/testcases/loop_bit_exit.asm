@@ -0,0 +1,12 @@
+        lw      0   1   one
+        lw      0   6   mask
+        lw      0   7   lim
+loop    add     4   1   4
+        beq     4   7   out         counter exit, far away
+        nand    4   6   5
+        nand    5   5   2           r2 = r4 & mask
+        beq     2   0   loop        leaves once the bit comes up
+out     halt
+one     .fill   1
+mask    .fill   64
+lim     .fill   1000
@@ -0,0 +1,10 @@
+        lw      0   3   one
+        lw      0   1   base
+loop    add     1   3   1
+        add     2   3   2
+        lw      1   4   32767       out of memory from the 4000th iteration
+        add     4   2   2
+        beq     0   0   loop
+        halt
+one     .fill   1
+base    .fill   28768
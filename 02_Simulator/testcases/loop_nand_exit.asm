@@ -0,0 +1,13 @@
+        lw      0   1   one
+        lw      0   6   mask
+        lw      0   7   lim
+        nand    6   6   3           r3 = ~mask
+loop    add     4   1   4
+        nand    4   6   5
+        beq     5   3   out         taken once the bit comes up
+        beq     4   7   out         counter exit, far away
+        beq     0   0   loop
+out     halt
+one     .fill   1
+mask    .fill   64
+lim     .fill   1000
@@ -0,0 +1,12 @@
+        lw      0   1   end         r1 = address of end
+        lw      1   2   -1          r2 = word just before end
+        lw      0   3   one
+        add     2   3   2
+        sw      1   2   -1          store it back below end
+        lw      1   4   -1
+        lw      1   5   -2
+        halt
+one     .fill   1
+        .fill   -7
+value   .fill   41
+end     .fill   end
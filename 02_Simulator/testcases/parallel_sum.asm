@@ -0,0 +1,33 @@
+start       lw      0   2   harts       stride: the number of harts
+            lw      0   3   count
+            add     1   3   3           this hart stops at index id + count
+            add     0   1   4           i = hart id, passed in reg 1
+loop        beq     4   3   done
+            lw      4   6   data
+            add     5   6   5
+            add     4   2   4
+            beq     0   0   loop
+done        sw      1   5   sums        sums[id] = data[id] + data[id + harts] + ...
+            halt
+harts       .fill   4
+count       .fill   16
+data        .fill   1
+            .fill   2
+            .fill   3
+            .fill   4
+            .fill   5
+            .fill   6
+            .fill   7
+            .fill   8
+            .fill   9
+            .fill   10
+            .fill   11
+            .fill   12
+            .fill   13
+            .fill   14
+            .fill   15
+            .fill   16
+sums        .fill   0
+            .fill   0
+            .fill   0
+            .fill   0
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+# Checks the fast mode (-f) against a full trace: the same total cycles,
+# the same cycles per opcode and the same final state; negative_offset
+# covers lw and sw below their base register. Given the
+# functional simulator too, checks that a sampled run (simulate -S) whose
+# windows cover every instruction counts exactly the cycles of -f.
+import subprocess
+import os.path
+import sys
+
+testCases = [
+        'basic_test.asm.mc',
+        'basic_test2.asm.mc',
+        'combination.asm.mc',
+        'combination_optimized.asm.mc',
+        'factorial.asm.mc',
+        'factorial_iterative.asm.mc',
+        'factorial_tail_call.asm.mc',
+        'fib.asm.mc',
+        'fib_tail_call.asm.mc',
+        'multiplication.asm.mc',
+        'negative_offset.asm.mc',
+        ]
+
+opcodes = ['add', 'nand', 'lw', 'sw', 'beq', 'jalr', 'halt', 'noop']
+
+class WrongOutput(Exception):
+    def __init__(self, what, exp, rel):
+        self.what = what
+        self.exp = exp
+        self.rel = rel
+
+    def __str__(self):
+        return ('%s:\nExpectancy: %s\nReality:    %s'
+                % (self.what, str(self.exp).strip(), str(self.rel).strip()))
+
+def run(args):
+    result = subprocess.run([simulator] + args, stdout = subprocess.PIPE,
+            stderr = subprocess.DEVNULL, universal_newlines = True)
+    if result.returncode:
+        raise WrongOutput(' '.join(args), 'exit status 0', result.returncode)
+    return result.stdout
+
+def traceCycles(infile):
+    # Streams the full trace, which is too big to hold for long programs.
+    # Every state is one cycle and belongs to the instruction whose fetch
+    # started it; the state after `branch` names the opcode.
+    process = subprocess.Popen([simulator, infile], stdout = subprocess.PIPE,
+            stderr = subprocess.DEVNULL, universal_newlines = True)
+    cycles = dict.fromkeys(opcodes, 0)
+    total = current = 0
+    previous = opcode = None
+    last = []
+    for line in process.stdout:
+        if line.startswith('@@@'):
+            last = []
+        last.append(line)
+        if not line.startswith('state '):
+            continue
+        state = line.split()[1]
+        if state == 'fetch' and total:
+            cycles[opcode] += total - current
+            current = total
+        if previous == 'branch':
+            opcode = state
+        previous = state
+        total += 1
+    if process.wait():
+        raise WrongOutput(infile, 'exit status 0', process.returncode)
+    cycles[opcode] += total - current
+    return total, cycles, ''.join(last).rstrip()
+
+def fastCycles(output):
+    lines = output.splitlines()
+    start = lines.index('machine halted')
+    total = int(lines[start + 1].split()[2])
+    cycles = dict.fromkeys(opcodes, 0)
+    for line in lines[start + 3:]:
+        fields = line.split()
+        cycles[fields[0]] = int(fields[2])
+    return total, cycles
+
+def finalState(output):
+    state = output[output.rindex('@@@'):]
+    return state[:state.find('\nmachine halted')].rstrip()
+
+def testFast(infile):
+    total, cycles, final = traceCycles(infile)
+    fast = run(['-f', infile])
+    fastTotal, fastCycles_ = fastCycles(fast)
+    if total != fastTotal:
+        raise WrongOutput('total cycles', total, fastTotal)
+    for opcode in opcodes:
+        if cycles[opcode] != fastCycles_[opcode]:
+            raise WrongOutput(opcode + ' cycles', cycles[opcode], fastCycles_[opcode])
+    if final != finalState(fast):
+        raise WrongOutput('final state', final, finalState(fast))
+    return total
+
+def testSampled(infile, total):
+    args = [functional, '-S', simulator, '-W', '64', '-P', '64', infile]
+    result = subprocess.run(args, stdout = subprocess.PIPE,
+            stderr = subprocess.DEVNULL, universal_newlines = True)
+    if result.returncode:
+        raise WrongOutput(' '.join(args), 'exit status 0', result.returncode)
+    lines = result.stdout.splitlines()
+    for line in lines[lines.index('machine halted'):]:
+        if line.strip().startswith('cycles '):
+            sampled = int(line.split()[1])
+            if sampled != total:
+                raise WrongOutput('sampled cycles', total, sampled)
+            return
+    raise WrongOutput('sampled cycles', total, 'none reported')
+
+def main():
+    if len(sys.argv) < 3:
+        print('Usage: python3 autotest.py [fsm simulator] [path to test data] [functional simulator]')
+        return
+
+    global simulator, functional
+    simulator = sys.argv[1]
+    testDataPath = sys.argv[2]
+    functional = sys.argv[3] if len(sys.argv) > 3 else None
+
+    print('LC2K FSM Simulator Tests')
+    failureCount = 0
+
+    for infile in testCases:
+        try:
+            total = testFast(os.path.join(testDataPath, infile))
+            if functional:
+                testSampled(os.path.join(testDataPath, infile), total)
+        except WrongOutput as e:
+            print('---\nTest Case: %s ... Fail!' % infile)
+            print(e)
+            failureCount += 1
+        else:
+            print('---\nTest Case: %s ... Pass!' % infile)
+
+    print('---\nTesting finish!')
+    print('Success:', len(testCases) - failureCount)
+    print('Failure:', failureCount)
+    print('Total:', len(testCases))
+
+if __name__ == '__main__':
+    main()
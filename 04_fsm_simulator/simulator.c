@@ -2,10 +2,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+
+#include "../common/mapfile.h"
+#include "../common/archstate.h"
  
 #define NUMMEMORY 65536 /* maximum number of words in memory */
 #define NUMREGS 8 /* number of machine registers */
-#define MAXLINELENGTH 1000
  
 typedef struct stateStruct {
     int pc;
@@ -21,20 +23,29 @@ typedef struct stateStruct {
  
 void printState(stateType *, char *);
 void run(stateType);
+int stepFast(stateType *, int *);
+void runFast(stateType *);
+void runSampled(stateType *);
 int memoryAccess(stateType *, int);
+int accessCycles(stateType *, int);
 int convertNum(int);
+
+int cycle = 0; /* states printed so far */
  
 int main(int argc, char *argv[])
 {
     int i;
-    char line[MAXLINELENGTH];
+    const char *line, *end, *filename;
     stateType state;
-    FILE *filePtr;
+    MapFile file;
+    int fast = argc == 3 && strcmp(argv[1], "-f") == 0;
+    int sampled = argc == 2 && strcmp(argv[1], "-s") == 0;
  
-    if (argc != 2) {
-        printf("error: usage: %s <machine-code file>n", argv[0]);
+    if ((argc != 2 && !fast) || (argc == 2 && argv[1][0] == '-' && !sampled)) {
+        printf("error: usage: %s [-f] <machine-code file> | -s\n", argv[0]);
         exit(1);
     }
+    filename = argv[argc-1];
  
     /* initialize memories and registers */
     for (i=0; i<NUMMEMORY; i++) {
@@ -43,31 +54,46 @@ int main(int argc, char *argv[])
     for (i=0; i<NUMREGS; i++) {
         state.reg[i] = 0;
     }
+
+    /* the program and its state come with the records */
+    if (sampled) {
+        runSampled(&state);
+        return(0);
+    }
  
     /* read machine-code file into instruction/data memory (starting at
         address 0) */
  
-    filePtr = fopen(argv[1], "r");
-    if (filePtr == NULL) {
-        printf("error: can't open file %s\n", argv[1]);
+    if (mapfile_open(&file, filename) != 0) {
+        printf("error: can't open file %s\n", filename);
         perror("fopen");
         exit(1);
     }
  
-    for (state.numMemory=0; fgets(line, MAXLINELENGTH, filePtr) != NULL;
-        state.numMemory++) {
-        if (sscanf(line, "%d", state.mem+state.numMemory) != 1) {
+    /* one number per line, parsed straight from the mapped file */
+    line = file.data;
+    end = file.data + file.size;
+    for (state.numMemory=0; line != end; state.numMemory++) {
+        const char *eol = mapfile_eol(line, end);
+        if (mapfile_parse_int(mapfile_skip_space(line, eol), eol,
+                              state.mem+state.numMemory) == NULL) {
             printf("error in reading address %d\n", state.numMemory);
             exit(1);
         }
-        printf("memory[%d]=%d\n", state.numMemory, state.mem[state.numMemory]);
+        if (!fast)
+            printf("memory[%d]=%d\n", state.numMemory, state.mem[state.numMemory]);
+        line = eol == end ? end : eol + 1;
     }
- 
-    printf("\n");
+    mapfile_close(&file);
  
     /* run never returns */
     state.pc=0;
-    run(state);
+    if (fast) {
+        runFast(&state);
+    } else {
+        printf("\n");
+        run(state);
+    }
  
     return(0);
 }
@@ -75,7 +101,6 @@ int main(int argc, char *argv[])
 void printState(stateType *statePtr, char *stateName)
 {
     int i;
-    static int cycle = 0;
     printf("\n@@@\nstate %s (cycle %d)\n", stateName, cycle++);
     printf("\tpc %d\n", statePtr->pc);
     printf("\tmemory:\n");
@@ -139,6 +164,42 @@ int memoryAccess(stateType *statePtr, int readFlag)
     }
 }
  
+/*
+ * Fast-mode counterpart of memoryAccess(): does the access at once and
+ * returns the number of states the FSM spends on it, counting the state
+ * that starts it. A new access waits memoryAddress % 3 cycles and the
+ * FSM always passes through its *_delay state at least once, so that is
+ * 1 + max(delay, 1). Keeps its own copy of memoryAccess()'s history.
+ */
+int accessCycles(stateType *statePtr, int readFlag)
+{
+    static int lastAddress = -1;
+    static int lastReadFlag = 0;
+    static int lastData = 0;
+    int delay = 0;
+
+    if (statePtr->memoryAddress < 0 || statePtr->memoryAddress >= NUMMEMORY) {
+        printf("memory address out of range\n");
+        exit(1);
+    }
+
+    if ( (statePtr->memoryAddress != lastAddress) ||
+             (readFlag != lastReadFlag) ||
+             (readFlag == 0 && lastData != statePtr->memoryData) ) {
+        delay = statePtr->memoryAddress % 3;
+        lastAddress = statePtr->memoryAddress;
+        lastReadFlag = readFlag;
+        lastData = statePtr->memoryData;
+    }
+
+    if (readFlag) {
+        statePtr->memoryData = statePtr->mem[statePtr->memoryAddress];
+    } else {
+        statePtr->mem[statePtr->memoryAddress] = statePtr->memoryData;
+    }
+    return(1 + (delay > 1 ? delay : 1));
+}
+ 
 int convertNum(int num)
 {
     /* convert a 16-bit number into a 32-bit integer */
@@ -243,7 +304,7 @@ void run(stateType state)
         goto lw_addr;
 
     __STATE__(lw_addr)
-        bus = convertNum(_OFFSET);
+        bus = _OFFSET;
         state.aluResult = state.aluOperand + bus;
         goto lw_read;
 
@@ -270,7 +331,7 @@ void run(stateType state)
         goto sw_addr;
 
     __STATE__(sw_addr)
-        bus = convertNum(_OFFSET);
+        bus = _OFFSET;
         state.aluResult = state.aluOperand + bus;
         goto sw_allocate;
 
@@ -343,3 +404,147 @@ void run(stateType state)
     __STATE__(noop)
         goto fetch;
 }
+
+/*
+ * One instruction of the same machine as run(): every state is counted
+ * instead of visited and memory delays come from accessCycles(). The
+ * internal registers end up as run() leaves them. Returns the number of
+ * states, and the opcode in *opcodePtr.
+ */
+int stepFast(stateType *statePtr, int *opcodePtr)
+{
+    int cost, opcode, offset;
+    int *regA, *regB, *regDest;
+
+    /* fetch, fetch_delay, branch */
+    statePtr->memoryAddress = statePtr->pc++;
+    cost = accessCycles(statePtr, 1) + 1;
+    statePtr->instrReg = statePtr->memoryData;
+    opcode = (statePtr->instrReg >> 22) & 0x7;
+    regA = &statePtr->reg[(statePtr->instrReg >> 19) & 0x7];
+    regB = &statePtr->reg[(statePtr->instrReg >> 16) & 0x7];
+    regDest = &statePtr->reg[statePtr->instrReg & 0x7];
+    offset = convertNum(statePtr->instrReg & 0x0000ffff);
+
+    switch (opcode) {
+    case 0: /* add, add_calc, add_done */
+        statePtr->aluOperand = *regA;
+        statePtr->aluResult = *regB + statePtr->aluOperand;
+        *regDest = statePtr->aluResult;
+        cost += 3;
+        break;
+    case 1: /* nand, nand_calc, nand_done */
+        statePtr->aluOperand = *regA;
+        statePtr->aluResult = ~(*regB & statePtr->aluOperand);
+        *regDest = statePtr->aluResult;
+        cost += 3;
+        break;
+    case 2: /* lw, lw_addr, then lw_read and its delay */
+        statePtr->aluOperand = *regA;
+        statePtr->aluResult = statePtr->aluOperand + offset;
+        statePtr->memoryAddress = statePtr->aluResult;
+        cost += 2 + accessCycles(statePtr, 1);
+        *regB = statePtr->memoryData;
+        break;
+    case 3: /* sw, sw_addr, sw_allocate, then sw_write and its delay */
+        statePtr->aluOperand = *regA;
+        statePtr->aluResult = statePtr->aluOperand + offset;
+        statePtr->memoryAddress = statePtr->aluResult;
+        statePtr->memoryData = *regB;
+        cost += 3 + accessCycles(statePtr, 0);
+        break;
+    case 4: /* beq, beq_calc, beq_judge, and beq_addr, beq_pc if taken */
+        statePtr->aluOperand = *regA;
+        statePtr->aluResult = statePtr->aluOperand - *regB;
+        cost += 3;
+        if (!statePtr->aluResult) {
+            statePtr->aluOperand = offset;
+            statePtr->aluResult = statePtr->aluOperand + statePtr->pc;
+            statePtr->pc = statePtr->aluResult;
+            cost += 2;
+        }
+        break;
+    case 5: /* jalr, jalr_a */
+        *regB = statePtr->pc;
+        statePtr->pc = *regA;
+        cost += 2;
+        break;
+    case 6: /* halt */
+    case 7: /* noop */
+        cost += 1;
+        break;
+    }
+
+    *opcodePtr = opcode;
+    return cost;
+}
+
+/*
+ * run() without visiting the states: nothing is printed until the machine
+ * halts, so the final state matches the last one of a full trace.
+ */
+void runFast(stateType *statePtr)
+{
+    static const char *names[] = {"add", "nand", "lw", "sw", "beq", "jalr", "halt", "noop"};
+    long long count[8] = {0}, cycles[8] = {0};
+    long long total = 0, instructions = 0;
+    int opcode, cost;
+
+    do {
+        cost = stepFast(statePtr, &opcode);
+        count[opcode]++;
+        cycles[opcode] += cost;
+        instructions++;
+        total += cost;
+    } while (opcode != 6);
+
+    /* the halt state is the last cycle of a full trace */
+    cycle = (int)(total - 1);
+    printState(statePtr, "halt");
+
+    printf("\nmachine halted\n");
+    printf("total of %lld cycles for %lld instructions, CPI %.3f\n",
+           total, instructions, (double)total / instructions);
+    printf("%-6s %12s %12s %8s\n", "opcode", "instructions", "cycles", "CPI");
+    for (opcode = 0; opcode < 8; opcode++) {
+        if (count[opcode]) {
+            printf("%-6s %12lld %12lld %8.3f\n", names[opcode], count[opcode],
+                   cycles[opcode], (double)cycles[opcode] / count[opcode]);
+        }
+    }
+}
+
+/*
+ * Detailed windows of a sampled run (common/archstate.h): read a state
+ * from stdin, count the cycles of up to `window` instructions from it with
+ * stepFast(), answer on stdout and wait for the next one. Memory persists
+ * between records, which only carry the pages written since the last one,
+ * and so does accessCycles()' history, so back-to-back windows count
+ * exactly what one long run would.
+ */
+void runSampled(stateType *statePtr)
+{
+    ArchState arch;
+    long long instructions, total;
+    int i, opcode = 0, status;
+
+    while ((status = arch_read(stdin, &arch, statePtr->mem)) == 1) {
+        statePtr->pc = arch.pc;
+        for (i = 0; i < NUMREGS; i++) {
+            statePtr->reg[i] = arch.reg[i];
+        }
+        statePtr->numMemory = arch.numMemory;
+        instructions = total = 0;
+        opcode = 0;
+        while (instructions < arch.window && opcode != 6) {
+            total += stepFast(statePtr, &opcode);
+            instructions++;
+        }
+        printf("%lld %lld %d\n", instructions, total, opcode == 6);
+        fflush(stdout);
+    }
+    if (status < 0) {
+        printf("error: malformed state record\n");
+        exit(1);
+    }
+}
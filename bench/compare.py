@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+# Compares two result files written by `throughput` and lists every
+# measurement whose median rate changed by more than the threshold.
+# Exits with status 1 when something got slower.
+#
+#   ./compare.py old.jsonl new.jsonl [threshold percent (default 5)]
+import json
+import sys
+
+def load(filename):
+    results = {}
+    with open(filename) as f:
+        for line in f:
+            if line.strip():
+                r = json.loads(line)
+                results[(r['suite'], r['name'], r['mode'])] = r
+    return results
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        print('Usage: %s <old results> <new results> [threshold percent]' % sys.argv[0])
+        sys.exit(2)
+    old, new = load(sys.argv[1]), load(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) == 4 else 5.0
+
+    regressions = 0
+    for key in sorted(new):
+        if key not in old:
+            continue
+        before, after = old[key]['median'], new[key]['median']
+        change = (after - before) / before * 100
+        if abs(change) < threshold:
+            continue
+        # a median that moved less than the old run's own spread is noise
+        if old[key]['p99'] <= after <= old[key]['max']:
+            continue
+        if change < 0:
+            regressions += 1
+        print('%-4s %-24s %-10s %12.4g -> %12.4g %s  %+6.1f%%'
+              % (key + (before, after, new[key]['unit'], change)))
+    for key in sorted(set(old) - set(new)):
+        print('%-4s %-24s %-10s missing' % key)
+    print('%d regression(s) over %g%%' % (regressions, threshold))
+    sys.exit(1 if regressions else 0)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,129 @@
+// Load-time benchmark: the old line-by-line readers against the shared
+// mmap loader in common/mapfile.h, on copies of an .asm and an .mc file
+// scaled up by concatenation.
+//
+//   g++ -std=c++11 -O2 -o load load.cpp
+//   ./load ../01_Assembler/testcases/largeprogram.asm ../01_Assembler/testcases/largeprogram.mc 100
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iterator>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../common/mapfile.h"
+
+using namespace std;
+
+static string scaled(const char *filename, int scale)
+{
+    ifstream ifs(filename, ios::binary);
+    if (!ifs)
+    {
+        cerr << "Can not open file: " << filename << endl;
+        exit(EXIT_FAILURE);
+    }
+    string text((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+    if (!text.empty() && text[text.size() - 1] != '\n')
+        text += '\n';
+
+    string name = string(filename).substr(string(filename).find_last_of('/') + 1)
+                + ".x" + to_string(scale);
+    ofstream ofs(name.c_str(), ios::binary);
+    for (int i = 0; i < scale; ++i)
+        ofs << text;
+    return name;
+}
+
+// Best of five runs, printed with the count each run produced so that the
+// work can not be optimised away.
+template <class F>
+static void report(const string &what, F f)
+{
+    size_t result = 0;
+    double ms = 1e30;
+    for (int i = 0; i < 5; ++i)
+    {
+        auto start = chrono::steady_clock::now();
+        result = f();
+        chrono::duration<double, milli> d = chrono::steady_clock::now() - start;
+        ms = min(ms, d.count());
+    }
+    printf("%-28s %9.2f ms  (%zu)\n", what.c_str(), ms, result);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3 && argc != 4)
+    {
+        cerr << "Usage: " << argv[0] << " <asm file> <mc file> [scale (default 100)]" << endl;
+        return EXIT_FAILURE;
+    }
+    int scale = argc == 4 ? atoi(argv[3]) : 100;
+    string asmFile = scaled(argv[1], scale), mcFile = scaled(argv[2], scale);
+
+    // assembler: non-empty lines
+    report("asm getline", [&] {
+        ifstream input(asmFile.c_str());
+        vector<string> lines;
+        string tmp;
+        while (getline(input, tmp))
+            if (tmp != "")
+                lines.push_back(tmp);
+        return lines.size();
+    });
+    report("asm mapfile", [&] {
+        MapFile f;
+        mapfile_open(&f, asmFile.c_str());
+        vector<pair<const char *, size_t> > lines;
+        for (const char *p = f.data, *end = p + f.size; p != end; )
+        {
+            const char *eol = mapfile_eol(p, end);
+            if (eol != p)
+                lines.push_back(make_pair(p, eol - p));
+            p = eol == end ? end : eol + 1;
+        }
+        mapfile_close(&f);
+        return lines.size();
+    });
+
+    // simulators: one decimal word per line
+    report("mc ifstream >> int", [&] {
+        ifstream ifs(mcFile.c_str());
+        vector<int> mc;
+        int tmp;
+        while (ifs >> tmp)
+            mc.push_back(tmp);
+        return mc.size();
+    });
+    report("mc fgets + sscanf", [&] {
+        FILE *fp = fopen(mcFile.c_str(), "r");
+        vector<int> mc;
+        char line[1000];
+        int tmp;
+        while (fgets(line, sizeof(line), fp) && sscanf(line, "%d", &tmp) == 1)
+            mc.push_back(tmp);
+        fclose(fp);
+        return mc.size();
+    });
+    report("mc mapfile", [&] {
+        MapFile f;
+        mapfile_open(&f, mcFile.c_str());
+        vector<int> mc;
+        const char *p = f.data, *end = p + f.size;
+        int tmp;
+        while ((p = mapfile_skip_space(p, end)) != end
+               && (p = mapfile_parse_int(p, end, &tmp)))
+            mc.push_back(tmp);
+        mapfile_close(&f);
+        return mc.size();
+    });
+
+    remove(asmFile.c_str());
+    remove(mcFile.c_str());
+    return EXIT_SUCCESS;
+}
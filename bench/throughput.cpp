@@ -0,0 +1,366 @@
+// Throughput benchmark for the assembler, the functional simulator and the
+// FSM simulator. Every measurement is printed as one JSON object per line,
+// so results from different commits can be kept and compared with
+// compare.py.
+//
+//   g++ -std=c++11 -O2 -pthread -o throughput throughput.cpp ../01_Assembler/assembler.cpp ../02_Simulator/simulator.cpp ../02_Simulator/cache.cpp
+//   gcc -O2 -o fsm ../04_fsm_simulator/simulator.c
+//   ./throughput -C .. -f ./fsm -t $(git rev-parse --short HEAD) > results.jsonl
+//
+// Suites:
+//   asm  lines/s of encode(), encode_onepass() and encode_parallel() on
+//        largeprogram.asm and on generated programs of 10^4 .. 10^7 lines
+//   sim  instructions/s on each 02_Simulator testcase, traced (printState to
+//        /dev/null), untraced with every engine, and through the default
+//        cache model
+//   fsm  cycles/s of the FSM simulator binary given with -f, tracing every
+//        state to /dev/null and in its fast (-f) mode
+//
+// A sample repeats its workload until it has run for at least -w
+// milliseconds; each line reports the median and the 99th percentile (the
+// slow tail, so p99 <= median) of the per-sample rates over -r samples.
+
+#include "../01_Assembler/assembler.h"
+#include "../02_Simulator/simulator.h"
+#include "../02_Simulator/cache.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+static const char *const SIM_CASES[] = {
+    "basic_test", "basic_test2", "combination", "combination_optimized",
+    "factorial", "factorial_iterative", "factorial_tail_call", "fib",
+    "fib_tail_call", "multiplication",
+};
+
+struct Options
+{
+    string root;            // repository root
+    string fsm;             // FSM simulator binary, empty to skip that suite
+    string tag;             // copied into every record, e.g. a commit id
+    string suite;           // empty for all
+    int reps;
+    double minMs;
+    long long maxLines;
+};
+
+// Runs `work` (which returns the units it processed) until at least
+// `minMs` have passed and returns the rate in units per second.
+static double sample(const function<long long()> &work, double minMs)
+{
+    long long units = 0;
+    auto start = chrono::steady_clock::now();
+    chrono::duration<double, milli> elapsed;
+    do
+    {
+        units += work();
+        elapsed = chrono::steady_clock::now() - start;
+    } while (elapsed.count() < minMs);
+    return units / (elapsed.count() / 1000);
+}
+
+static string quote(const string &s)
+{
+    string out = "\"";
+    for (char c: s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + '"';
+}
+
+// One warm-up sample, then `reps` measured ones; prints a JSON line.
+static void measure(const Options &opt, const string &suite, const string &name,
+                    const string &mode, const string &unit, long long work,
+                    const function<long long()> &f)
+{
+    sample(f, 0);
+    vector<double> rates;
+    for (int i = 0; i < opt.reps; ++i)
+        rates.push_back(sample(f, opt.minMs));
+    sort(rates.begin(), rates.end());
+    // nearest rank, counted from the slow end
+    size_t tail = (rates.size() * 99 + 99) / 100;
+    double median = rates[rates.size() / 2];
+    double p99 = rates[rates.size() - tail];
+
+    ostringstream os;
+    os.precision(6);
+    os << "{\"suite\": " << quote(suite) << ", \"name\": " << quote(name)
+       << ", \"mode\": " << quote(mode) << ", \"unit\": " << quote(unit)
+       << ", \"work\": " << work << ", \"reps\": " << opt.reps
+       << ", \"median\": " << median << ", \"p99\": " << p99
+       << ", \"min\": " << rates.front() << ", \"max\": " << rates.back();
+    if (!opt.tag.empty())
+        os << ", \"tag\": " << quote(opt.tag);
+    os << "}";
+    cout << os.str() << endl;
+}
+
+static string readFile(const string &filename)
+{
+    ifstream ifs(filename.c_str(), ios::binary);
+    if (!ifs)
+        throw runtime_error("Can not open file: " + filename);
+    ostringstream os;
+    os << ifs.rdbuf();
+    return os.str();
+}
+
+// A valid program of `lines` lines using every operator: a label every
+// eight lines, short backward branches and data words holding addresses.
+static string synthetic(long long lines)
+{
+    static const char *const body[] = {
+        "add 1 2 3", "nand 3 4 5", "lw 0 1 D%lld", "sw 6 7 -12",
+        "beq 1 2 L%lld", "jalr 4 5", "noop", ".fill L%lld",
+    };
+    string text;
+    text.reserve(lines * 16);
+    char line[64];
+    for (long long i = 0; i < lines; ++i)
+    {
+        long long block = i / 8;
+        int n = 0;
+        if (i % 8 == 0)
+            n = snprintf(line, sizeof(line), "L%lld ", block);
+        else if (i % 8 == 7)
+            n = snprintf(line, sizeof(line), "D%lld ", block);
+        n += snprintf(line + n, sizeof(line) - n, body[i % 8], block);
+        text.append(line, n);
+        text += '\n';
+    }
+    return text;
+}
+
+static void assemblerSuite(const Options &opt)
+{
+    vector<pair<string, string> > inputs;
+    inputs.push_back(make_pair(string("largeprogram.asm"),
+                               readFile(opt.root + "/01_Assembler/testcases/largeprogram.asm")));
+    for (long long lines = 10000; lines <= opt.maxLines; lines *= 10)
+        inputs.push_back(make_pair("synthetic-" + to_string(lines), synthetic(lines)));
+
+    static const char *const modes[] = {"twopass", "onepass", "parallel"};
+    for (auto &input: inputs)
+        for (int m = 0; m < 3; ++m)
+        {
+            Assembler asmer;
+            auto f = [&]() -> long long {
+                asmer.import(input.second);
+                if (m == 0)
+                    asmer.encode();
+                else if (m == 1)
+                    asmer.encode_onepass();
+                else
+                    asmer.encode_parallel();
+                return asmer.line_count();
+            };
+            long long lines = f();
+            measure(opt, "asm", input.first, modes[m], "lines/s", lines, f);
+        }
+}
+
+static void simulatorSuite(const Options &opt)
+{
+    static const char *const engines[] = {"switch", "threaded", "superblock", "jit"};
+    ofstream devnull("/dev/null");
+    Simulator simulator;
+    for (auto name: SIM_CASES)
+    {
+        string file = opt.root + "/02_Simulator/testcases/" + name + ".asm.mc";
+        simulator.reset();
+        simulator.loadFromFile(file);
+        vector<Simulator::word_t> words;
+        for (int i = 0; i < simulator.memSize(); ++i)
+            words.push_back(simulator.peek(i));
+
+        auto traced = [&]() -> long long {
+            simulator.reset();
+            simulator.setEngine(Simulator::SWITCH);
+            simulator.setMC(words.data(), words.size());
+            simulator.printInit(devnull);
+            simulator.printState(devnull);
+            long long count = 0;
+            while (simulator.next())
+            {
+                simulator.printState(devnull);
+                count++;
+            }
+            simulator.printSummary(count, simulator.halted(), devnull);
+            return count;
+        };
+        measure(opt, "sim", name, "trace", "instructions/s", traced(), traced);
+
+        for (auto engineName: engines)
+        {
+            Simulator::Engine engine;
+            Simulator::parseEngine(engineName, engine);
+            auto quiet = [&]() -> long long {
+                simulator.reset();
+                simulator.setEngine(engine);
+                simulator.setMC(words.data(), words.size());
+                return simulator.run();
+            };
+            measure(opt, "sim", name, engineName, "instructions/s", quiet(), quiet);
+        }
+
+        Cache::Config config;
+        CacheModel::Timing timing;
+        bool unified;
+        string error;
+        CacheModel::parse("default", config, timing, unified, error);
+        auto cached = [&]() -> long long {
+            CacheModel model(config, timing, unified);
+            simulator.reset();
+            simulator.setMC(words.data(), words.size());
+            return simulator.runObserved(model);
+        };
+        measure(opt, "sim", name, "cache", "instructions/s", cached(), cached);
+    }
+}
+
+// Runs the FSM simulator on `file` with its output sent to `fd`.
+static void spawnFsm(const Options &opt, const string &file, int fd, bool fast = false)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        throw runtime_error("fork failed");
+    if (pid == 0)
+    {
+        dup2(fd, STDOUT_FILENO);
+        if (fast)
+            execl(opt.fsm.c_str(), opt.fsm.c_str(), "-f", file.c_str(), (char *)NULL);
+        else
+            execl(opt.fsm.c_str(), opt.fsm.c_str(), file.c_str(), (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw runtime_error("FSM simulator failed on " + file);
+}
+
+// Cycles of one FSM run, counted from the state banners it prints.
+static long long fsmCycles(const Options &opt, const string &file)
+{
+    char path[] = "/tmp/lc2k-fsm-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        throw runtime_error("Can not create temporary file");
+    spawnFsm(opt, file, fd);
+    close(fd);
+    string output = readFile(path);
+    remove(path);
+    long long cycles = 0;
+    for (size_t p = 0; (p = output.find("\n@@@\n", p)) != string::npos; ++p)
+        cycles++;
+    return cycles;
+}
+
+static void fsmSuite(const Options &opt)
+{
+    int devnull = open("/dev/null", O_WRONLY);
+    for (auto name: SIM_CASES)
+    {
+        string file = opt.root + "/02_Simulator/testcases/" + name + ".asm.mc";
+        long long cycles = fsmCycles(opt, file);
+        auto f = [&]() -> long long {
+            spawnFsm(opt, file, devnull);
+            return cycles;
+        };
+        measure(opt, "fsm", name, "print", "cycles/s", cycles, f);
+        auto fast = [&]() -> long long {
+            spawnFsm(opt, file, devnull, true);
+            return cycles;
+        };
+        measure(opt, "fsm", name, "fast", "cycles/s", cycles, fast);
+    }
+    close(devnull);
+}
+
+static void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [-C <repo root>] [-f <fsm binary>] [-t <tag>]" << endl
+         << "       [-s asm|sim|fsm] [-r <reps>] [-w <ms per sample>] [-m <max synthetic lines>]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt = {".", "", "", "", 11, 20, 10000000};
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (i + 1 == argc)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (arg == "-C")
+            opt.root = argv[++i];
+        else if (arg == "-f")
+            opt.fsm = argv[++i];
+        else if (arg == "-t")
+            opt.tag = argv[++i];
+        else if (arg == "-s")
+            opt.suite = argv[++i];
+        else if (arg == "-r")
+            opt.reps = atoi(argv[++i]);
+        else if (arg == "-w")
+            opt.minMs = atof(argv[++i]);
+        else if (arg == "-m")
+            opt.maxLines = atoll(argv[++i]);
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (opt.reps < 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        if (opt.suite.empty() || opt.suite == "asm")
+            assemblerSuite(opt);
+        if (opt.suite.empty() || opt.suite == "sim")
+            simulatorSuite(opt);
+        if (opt.suite == "fsm" || (opt.suite.empty() && !opt.fsm.empty()))
+        {
+            if (opt.fsm.empty())
+                throw runtime_error("The fsm suite needs the simulator binary (-f)");
+            fsmSuite(opt);
+        }
+    }
+    catch (SyntaxError &e)
+    {
+        cerr << "SyntaxError occured: " << endl << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    catch (exception &e)
+    {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/* Architectural state handed from the functional simulator to the FSM
+ * simulator for sampled simulation: pc, registers and the memory pages
+ * written since the previous record, so the receiver's memory follows
+ * along without copying all of it every time. All integers are
+ * little-endian:
+ *
+ *   "LCAS", i32 pc, i32 reg[8], u32 numMemory, u32 window, u32 pages
+ *   pages x (u32 page, i32 word[ARCH_PAGE_WORDS])
+ *
+ * `window` is the number of instructions the receiver should simulate in
+ * detail from that state. It answers every record with one text line,
+ * "<instructions> <cycles> <halted>".
+ *
+ * Header-only; usable from both C and C++.
+ */
+#ifndef LC2K_ARCHSTATE_H
+#define LC2K_ARCHSTATE_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "objfile.h"
+
+#define ARCH_MAGIC "LCAS"
+#define ARCH_NUMREGS 8
+#define ARCH_MEMORY_WORDS 65536
+#define ARCH_PAGE_WORDS 256
+#define ARCH_HEADER (4 + 4 * (1 + ARCH_NUMREGS + 3))
+
+typedef struct
+{
+    int pc;
+    int reg[ARCH_NUMREGS];
+    unsigned numMemory;     /* words of the program image, for printing */
+    unsigned window;
+    unsigned pages;         /* page records that follow the header */
+} ArchState;
+
+/* Writers send the header and then exactly `pages` pages. Return 0 on
+ * success and -1 when the stream fails. */
+static inline int arch_write(FILE *f, const ArchState *s)
+{
+    unsigned char buf[ARCH_HEADER];
+    int i;
+    memcpy(buf, ARCH_MAGIC, 4);
+    lc2k_put32(buf + 4, (unsigned)s->pc);
+    for (i = 0; i < ARCH_NUMREGS; ++i)
+        lc2k_put32(buf + 8 + 4 * i, (unsigned)s->reg[i]);
+    lc2k_put32(buf + 8 + 4 * ARCH_NUMREGS, s->numMemory);
+    lc2k_put32(buf + 12 + 4 * ARCH_NUMREGS, s->window);
+    lc2k_put32(buf + 16 + 4 * ARCH_NUMREGS, s->pages);
+    return fwrite(buf, 1, sizeof(buf), f) == sizeof(buf) ? 0 : -1;
+}
+
+static inline int arch_write_page(FILE *f, unsigned page, const int *words)
+{
+    unsigned char buf[4 + 4 * ARCH_PAGE_WORDS];
+    int i;
+    lc2k_put32(buf, page);
+    for (i = 0; i < ARCH_PAGE_WORDS; ++i)
+        lc2k_put32(buf + 4 + 4 * i, (unsigned)words[i]);
+    return fwrite(buf, 1, sizeof(buf), f) == sizeof(buf) ? 0 : -1;
+}
+
+/* Read one record, storing its pages into `mem` (ARCH_MEMORY_WORDS
+ * words). Return 1 for a record, 0 at the end of the stream and -1 for
+ * anything malformed or truncated. */
+static inline int arch_read(FILE *f, ArchState *s, int *mem)
+{
+    unsigned char buf[4 + 4 * ARCH_PAGE_WORDS];
+    unsigned n, page;
+    int i;
+    n = (unsigned)fread(buf, 1, ARCH_HEADER, f);
+    if (n == 0)
+        return 0;
+    if (n != ARCH_HEADER || memcmp(buf, ARCH_MAGIC, 4) != 0)
+        return -1;
+    s->pc = (int)lc2k_get32(buf + 4);
+    for (i = 0; i < ARCH_NUMREGS; ++i)
+        s->reg[i] = (int)lc2k_get32(buf + 8 + 4 * i);
+    s->numMemory = lc2k_get32(buf + 8 + 4 * ARCH_NUMREGS);
+    s->window = lc2k_get32(buf + 12 + 4 * ARCH_NUMREGS);
+    s->pages = lc2k_get32(buf + 16 + 4 * ARCH_NUMREGS);
+    if (s->numMemory > ARCH_MEMORY_WORDS)
+        return -1;
+    for (n = 0; n < s->pages; ++n)
+    {
+        if (fread(buf, 1, sizeof(buf), f) != sizeof(buf))
+            return -1;
+        page = lc2k_get32(buf);
+        if (page >= ARCH_MEMORY_WORDS / ARCH_PAGE_WORDS)
+            return -1;
+        for (i = 0; i < ARCH_PAGE_WORDS; ++i)
+            mem[page * ARCH_PAGE_WORDS + i] = (int)lc2k_get32(buf + 4 + 4 * i);
+    }
+    return 1;
+}
+
+#endif
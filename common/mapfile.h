@@ -0,0 +1,148 @@
+/* Whole-file input shared by the assembler and both simulators.
+ *
+ * mapfile_open() maps a file read-only (or reads it into one buffer where
+ * mmap is not available), so loaders can parse straight from memory
+ * instead of going through getline/fgets/operator>> line by line. The
+ * parsers below work on [p, end) ranges and never need a terminating NUL.
+ *
+ * Header-only; usable from both C and C++.
+ */
+#ifndef LC2K_MAPFILE_H
+#define LC2K_MAPFILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LC2K_MAPFILE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+    const char *data;
+    size_t size;
+    int mapped;     /* data came from mmap() rather than malloc() */
+} MapFile;
+
+/* Return 0 on success and -1 if the file can not be opened or read. */
+static inline int mapfile_open(MapFile *f, const char *path)
+{
+    f->data = NULL;
+    f->size = 0;
+    f->mapped = 0;
+#ifdef LC2K_MAPFILE_MMAP
+    {
+        struct stat st;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return -1;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            void *map = NULL;
+            f->size = (size_t)st.st_size;
+            if (f->size)
+                map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                close(fd);
+                f->data = (const char *)map;
+                f->mapped = map != NULL;
+                return 0;
+            }
+            f->size = 0;
+        }
+        close(fd);
+    }
+#endif
+    {
+        /* pipes, devices and hosts without mmap */
+        FILE *fp = fopen(path, "rb");
+        char *buf = NULL;
+        size_t cap = 0, n;
+        if (!fp)
+            return -1;
+        do
+        {
+            char *grown;
+            cap = cap ? 2 * cap : 1 << 16;
+            grown = (char *)realloc(buf, cap);
+            if (!grown)
+            {
+                free(buf);
+                fclose(fp);
+                return -1;
+            }
+            buf = grown;
+            n = fread(buf + f->size, 1, cap - f->size, fp);
+            f->size += n;
+        } while (f->size == cap);
+        fclose(fp);
+        f->data = buf;
+    }
+    return 0;
+}
+
+static inline void mapfile_close(MapFile *f)
+{
+#ifdef LC2K_MAPFILE_MMAP
+    if (f->mapped)
+        munmap((void *)f->data, f->size);
+    else
+#endif
+        free((void *)f->data);
+    f->data = NULL;
+    f->size = 0;
+    f->mapped = 0;
+}
+
+/* Whitespace as isspace() sees it in the C locale. */
+static inline int mapfile_isspace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline const char *mapfile_skip_space(const char *p, const char *end)
+{
+    while (p != end && mapfile_isspace(*p))
+        ++p;
+    return p;
+}
+
+/* End of the line starting at p: the next '\n', or end. */
+static inline const char *mapfile_eol(const char *p, const char *end)
+{
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+/* Parse an optionally signed decimal int at p. Return the position after
+ * it, or NULL when there is no number there or it does not fit an int,
+ * which is where `stream >> int` stops as well. */
+static inline const char *mapfile_parse_int(const char *p, const char *end, int *value)
+{
+    int neg = 0;
+    unsigned long long limit, v = 0;
+    const char *digits;
+    if (p != end && (*p == '+' || *p == '-'))
+        neg = *p++ == '-';
+    limit = neg ? (unsigned long long)INT_MAX + 1 : (unsigned long long)INT_MAX;
+    for (digits = p; p != end && *p >= '0' && *p <= '9'; ++p)
+    {
+        v = v * 10 + (unsigned long long)(*p - '0');
+        if (v > limit)
+            return NULL;
+    }
+    if (p == digits)
+        return NULL;
+    *value = neg ? (int)(0 - v) : (int)v;
+    return p;
+}
+
+#endif
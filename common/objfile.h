@@ -0,0 +1,140 @@
+/* Binary machine-code object format, the alternative to one decimal word
+ * per line. All integers are little-endian:
+ *
+ *   "LCOB", u32 version, u32 flags (0), u32 words, u32 symbols
+ *   i32 word[words]
+ *   symbols x (u32 address, u16 length, name[length])
+ *   u32 FNV-1a of everything before it
+ *
+ * The words start 4-byte aligned, so a mapped object can be read in
+ * place. Header-only; usable from both C and C++.
+ */
+#ifndef LC2K_OBJFILE_H
+#define LC2K_OBJFILE_H
+
+#include <stddef.h>
+#include <string.h>
+
+#define OBJ_MAGIC "LCOB"
+#define OBJ_VERSION 1
+#define OBJ_HEADER 20
+
+typedef struct
+{
+    unsigned words;
+    unsigned symbols;
+    const unsigned char *word;      /* first word */
+    const unsigned char *symbol;    /* first symbol record */
+} ObjImage;
+
+static inline unsigned lc2k_get32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+static inline void lc2k_put32(unsigned char *p, unsigned v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static inline unsigned lc2k_fnv32(const unsigned char *p, size_t n)
+{
+    unsigned hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < n; ++i)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline int obj_is_object(const void *data, size_t size)
+{
+    return size >= 4 && memcmp(data, OBJ_MAGIC, 4) == 0;
+}
+
+/* Bytes needed for an object with the given words and total symbol name
+ * length. */
+static inline size_t obj_size(unsigned words, unsigned symbols, size_t names)
+{
+    return OBJ_HEADER + 4 * (size_t)words + 6 * (size_t)symbols + names + 4;
+}
+
+/* Writers fill in the header, the words and the symbols and then seal
+ * the buffer, which appends the checksum. */
+static inline unsigned char *obj_begin(unsigned char *p, unsigned words, unsigned symbols)
+{
+    memcpy(p, OBJ_MAGIC, 4);
+    lc2k_put32(p + 4, OBJ_VERSION);
+    lc2k_put32(p + 8, 0);
+    lc2k_put32(p + 12, words);
+    lc2k_put32(p + 16, symbols);
+    return p + OBJ_HEADER;
+}
+
+static inline unsigned char *obj_put_symbol(unsigned char *p, unsigned address,
+                                            const char *name, unsigned length)
+{
+    lc2k_put32(p, address);
+    p[4] = (unsigned char)length;
+    p[5] = (unsigned char)(length >> 8);
+    memcpy(p + 6, name, length);
+    return p + 6 + length;
+}
+
+static inline void obj_seal(unsigned char *data, size_t size)
+{
+    lc2k_put32(data + size - 4, lc2k_fnv32(data, size - 4));
+}
+
+/* Check an object and locate its parts. Return 0 on success, -1 when the
+ * data is not an object, -2 for an unsupported version and -3 when it is
+ * truncated or fails its checksum. */
+static inline int obj_parse(const void *data, size_t size, ObjImage *obj)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + size;
+    const unsigned char *s;
+    unsigned i;
+    if (!obj_is_object(data, size))
+        return -1;
+    if (size < OBJ_HEADER + 4)
+        return -3;
+    if (lc2k_get32(p + 4) != OBJ_VERSION)
+        return -2;
+    obj->words = lc2k_get32(p + 12);
+    obj->symbols = lc2k_get32(p + 16);
+    if (obj->words > (size - OBJ_HEADER - 4) / 4
+        || lc2k_get32(end - 4) != lc2k_fnv32(p, size - 4))
+        return -3;
+    obj->word = p + OBJ_HEADER;
+    obj->symbol = obj->word + 4 * (size_t)obj->words;
+    for (s = obj->symbol, i = 0; i < obj->symbols; ++i)
+    {
+        if (end - 4 - s < 6 || end - 4 - s - 6 < (s[4] | s[5] << 8))
+            return -3;
+        s += 6 + (s[4] | s[5] << 8);
+    }
+    return s == end - 4 ? 0 : -3;
+}
+
+static inline int obj_word(const ObjImage *obj, unsigned i)
+{
+    return (int)lc2k_get32(obj->word + 4 * (size_t)i);
+}
+
+/* Read the symbol record at p and return the next one. */
+static inline const unsigned char *obj_symbol(const unsigned char *p, unsigned *address,
+                                              const char **name, unsigned *length)
+{
+    *address = lc2k_get32(p);
+    *length = p[4] | p[5] << 8;
+    *name = (const char *)p + 6;
+    return p + 6 + *length;
+}
+
+#endif
@@ -0,0 +1,689 @@
+// One driver over the assembler and simulator libraries: source goes
+// through Assembler into Simulator::setMC() in memory, with no machine-code
+// file and no second process.
+//
+//   g++ -std=c++11 -O2 -pthread -o lc2k lc2k.cpp ../01_Assembler/assembler.cpp ../02_Simulator/simulator.cpp ../02_Simulator/pipeline.cpp ../02_Simulator/cache.cpp ../02_Simulator/history.cpp ../02_Simulator/analysis.cpp
+//
+//   lc2k run [-q] [-n <budget>] [-e <engine> | -p <predictor> | -c <cache>] <asm file>
+//       assemble and run, printing what `simulate` prints for the .mc
+//   lc2k check [-n <budget>] <asm file>...
+//       assemble each file and check that every engine, and the pipeline
+//       model with every predictor, reaches the same final state or fault
+//       after as many instructions as the reference interpreter, that
+//       recorded runs step back and replay to the states of straight runs,
+//       and that skipping loops by their closed forms changes nothing
+//   lc2k profile [-n <budget>] <asm file>
+//       run on the reference interpreter and print the source annotated
+//       with execution counts, then per-opcode, per-label, jalr and
+//       memory summaries
+//   lc2k analyze <asm file>
+//       print the control-flow graph, the callees, the natural loops with
+//       whether each has a closed form, and the code no path reaches
+//   lc2k debug [-e <engine>] <asm file>
+//       reverse debugger reading commands from stdin: step forwards and
+//       backwards, continue either way to a breakpoint or a write to a
+//       watched word, go to any instruction count
+
+#include "../01_Assembler/assembler.h"
+#include "../02_Simulator/simulator.h"
+#include "../02_Simulator/profile.h"
+#include "../02_Simulator/pipeline.h"
+#include "../02_Simulator/cache.h"
+#include "../02_Simulator/history.h"
+#include "../02_Simulator/analysis.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace std;
+
+static void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " run [-q] [-n <budget>] [-e <engine> | -p <predictor> | -c <cache>] <asm file>" << endl
+         << "       " << prog << " check [-n <budget>] <asm file>..." << endl
+         << "       " << prog << " profile [-n <budget>] <asm file>" << endl
+         << "       " << prog << " analyze <asm file>" << endl
+         << "       " << prog << " debug [-e <engine>] <asm file>" << endl;
+}
+
+// Assembles `filename`; on error prints the assembler's diagnostic.
+static bool assemble(Assembler &asmer, const string &filename)
+{
+    try
+    {
+        asmer.loadFromFile(filename);
+        asmer.encode();
+        return true;
+    }
+    catch (IOError &e)
+    {
+        cerr << "IOError occured: " << endl << e.what() << endl;
+    }
+    catch (SyntaxError &e)
+    {
+        cerr << "SyntaxError occured: " << endl << e.what() << endl;
+    }
+    return false;
+}
+
+// A `predictor` runs the pipeline model and a `cache` the cache model
+// instead of the functional engine; both print their statistics after the
+// final state.
+static int run(Simulator::Engine engine, const Pipeline::Predictor *predictor,
+               const string *cache, bool quiet, long long budget, const string &filename)
+{
+    Assembler asmer;
+    if (!assemble(asmer, filename))
+        return EXIT_FAILURE;
+    const vector<Assembler::mc_t> &code = asmer.get_code();
+
+    Simulator simulator;
+    simulator.setEngine(engine);
+    long long count = 0;
+    try
+    {
+        simulator.setMC(code.data(), code.size());
+        if (predictor)
+        {
+            Pipeline pipeline(simulator, *predictor);
+            count = pipeline.run(budget);
+            simulator.printSummary(count, simulator.halted());
+            pipeline.printStats();
+            return EXIT_SUCCESS;
+        }
+        if (cache)
+        {
+            Cache::Config config;
+            CacheModel::Timing timing;
+            bool unified;
+            string error;
+            if (!CacheModel::parse(*cache, config, timing, unified, error))
+                throw runtime_error(error + "\n");
+            CacheModel model(config, timing, unified);
+            count = simulator.runObserved(model, budget);
+            simulator.printSummary(count, simulator.halted());
+            model.printStats();
+            return EXIT_SUCCESS;
+        }
+        if (quiet)
+            count = simulator.run(budget);
+        else
+        {
+            simulator.printInit();
+            simulator.printState();
+            while ((budget < 0 || count < budget) && simulator.next())
+            {
+                simulator.printState();
+                count++;
+            }
+        }
+        simulator.printSummary(count, simulator.halted());
+    }
+    catch (runtime_error &e)
+    {
+        cerr << e.what();
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+struct Outcome
+{
+    string error;
+    long long count;
+    bool halted;
+    unsigned long long hash;
+
+    bool operator==(const Outcome &o) const
+    {
+        return error == o.error && count == o.count && halted == o.halted && hash == o.hash;
+    }
+};
+
+static Outcome execute(Simulator &simulator, const vector<Assembler::mc_t> &code,
+                       Simulator::Engine engine, long long budget,
+                       const Pipeline::Predictor *predictor = NULL)
+{
+    Outcome outcome = {"", 0, false, 0};
+    simulator.reset();
+    simulator.setEngine(engine);
+    Pipeline pipeline(simulator, predictor ? *predictor : Pipeline::NOT_TAKEN);
+    try
+    {
+        simulator.setMC(code.data(), code.size());
+        if (predictor)
+            outcome.count = pipeline.run(budget);
+        else if (engine == Simulator::SWITCH)
+            while ((budget < 0 || outcome.count < budget) && simulator.next())
+                outcome.count++;
+        else
+            outcome.count = simulator.run(budget);
+    }
+    catch (runtime_error &e)
+    {
+        // a fault still compares the instructions executed before it
+        outcome.error = e.what();
+        if (predictor)
+            outcome.count = pipeline.stats().instructions;
+        else if (engine != Simulator::SWITCH)
+            outcome.count = simulator.retired();
+    }
+    outcome.halted = simulator.halted();
+    outcome.hash = simulator.stateHash();
+    return outcome;
+}
+
+// Runs the program under History, then checks that going back to the
+// middle, to the start, forward to the end again and back before a
+// fast-forward checkpoint all reach the states of straight runs.
+static string checkHistory(Simulator &simulator, const vector<Assembler::mc_t> &code,
+                           long long budget, const Outcome &reference)
+{
+    simulator.reset();
+    simulator.setEngine(Simulator::SWITCH);
+    simulator.setMC(code.data(), code.size());
+    const unsigned long long start = simulator.stateHash();
+    History history(simulator);
+    int at;
+    try
+    {
+        history.proceed(budget, at);
+    }
+    catch (runtime_error &)
+    {
+    }
+    const long long end = history.count();
+    if (end != reference.count || simulator.stateHash() != reference.hash)
+        return "Recording disagrees with switch.";
+
+    const long long mid = end / 2;
+    Simulator straight;
+    const Outcome middle = execute(straight, code, Simulator::SWITCH, mid);
+    const Outcome quarter = execute(straight, code, Simulator::SWITCH, mid / 2);
+    history.seek(mid);
+    if (simulator.stateHash() != middle.hash)
+        return "Stepping back to instruction " + to_string(mid) + " disagrees with switch.";
+    history.seek(0);
+    if (simulator.stateHash() != start)
+        return "Stepping back to the start does not restore the initial state.";
+    try
+    {
+        history.seek(end);
+    }
+    catch (runtime_error &)
+    {
+    }
+    if (history.count() != end || simulator.stateHash() != reference.hash)
+        return "Replaying to the end disagrees with switch.";
+    history.seek(0);
+    history.fastForward(mid);
+    history.seek(mid / 2);
+    if (history.checkpoint() != mid / 2 || simulator.stateHash() != quarter.hash)
+        return "Replaying to before a checkpoint disagrees with switch.";
+    return "";
+}
+
+// Runs the program skipping loops, once checking every skip against
+// execution and once trusting the summaries, and compares both runs with
+// the reference.
+static string checkLoops(Simulator &simulator, const vector<Assembler::mc_t> &code,
+                         long long budget, const Outcome &reference)
+{
+    for (int verify = 1; verify >= 0; --verify)
+    {
+        simulator.reset();
+        simulator.setEngine(Simulator::SWITCH);
+        simulator.setMC(code.data(), code.size());
+        LoopSkipper skipper(simulator, verify);
+        try
+        {
+            skipper.run(budget);
+        }
+        catch (runtime_error &e)
+        {
+            if (e.what() != reference.error)
+                return e.what();
+        }
+        if (skipper.count() != reference.count || simulator.stateHash() != reference.hash)
+            return verify ? "Verified loop skipping disagrees with switch."
+                          : "Loop skipping disagrees with switch.";
+    }
+    return "";
+}
+
+// In-process counterpart of 02_Simulator/autotest.py's engine comparison.
+static int check(long long budget, const vector<string> &files)
+{
+    static const char *const names[] = {"threaded", "superblock", "jit"};
+    Simulator simulator;
+    int failureCount = 0;
+
+    cout << "LC2K Engine Tests" << endl;
+    for (auto &file: files)
+    {
+        string failure;
+        Assembler asmer;
+        if (!assemble(asmer, file))
+            failure = "The assembler signals an error.";
+        else
+        {
+            Outcome reference = execute(simulator, asmer.get_code(), Simulator::SWITCH, budget);
+            for (auto name: names)
+            {
+                Simulator::Engine engine;
+                Simulator::parseEngine(name, engine);
+                if (!(execute(simulator, asmer.get_code(), engine, budget) == reference))
+                {
+                    failure = string("Engine ") + name + " disagrees with switch.";
+                    break;
+                }
+            }
+            for (int p = Pipeline::NOT_TAKEN; failure.empty() && p <= Pipeline::BIMODAL; ++p)
+            {
+                Pipeline::Predictor predictor = Pipeline::Predictor(p);
+                if (!(execute(simulator, asmer.get_code(), Simulator::SWITCH, budget, &predictor) == reference))
+                    failure = string("Pipeline with predictor ") + Pipeline::predictorName(predictor)
+                            + " disagrees with switch.";
+            }
+            if (failure.empty())
+                failure = checkHistory(simulator, asmer.get_code(), budget, reference);
+            if (failure.empty())
+                failure = checkLoops(simulator, asmer.get_code(), budget, reference);
+        }
+        if (failure.empty())
+            cout << "---\nTest Case: " << file << " ... Pass!" << endl;
+        else
+        {
+            cout << "---\nTest Case: " << file << " ... Fail!" << endl << failure << endl;
+            failureCount++;
+        }
+    }
+    cout << "---\nTesting finish!" << endl
+         << "Success: " << files.size() - failureCount << endl
+         << "Failure: " << failureCount << endl
+         << "Total: " << files.size() << endl;
+    return failureCount ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// "label" or "label+k" for the closest label at or below addr
+static string symbolize(const vector<pair<int, Token> > &symbols, int addr)
+{
+    auto it = upper_bound(symbols.begin(), symbols.end(), addr,
+                          [](int a, const pair<int, Token> &sym) { return a < sym.first; });
+    if (it == symbols.begin())
+        return to_string(addr);
+    --it;
+    if (it->first == addr)
+        return it->second.str();
+    return it->second.str() + "+" + to_string(addr - it->first);
+}
+
+static double percent(long long part, long long whole)
+{
+    return whole ? 100.0 * part / whole : 0;
+}
+
+static int profile(long long budget, const string &filename)
+{
+    static const char *const opcodes[] = {"add", "nand", "lw", "sw", "beq", "jalr", "halt", "noop"};
+    Assembler asmer;
+    if (!assemble(asmer, filename))
+        return EXIT_FAILURE;
+    const vector<Assembler::mc_t> &code = asmer.get_code();
+    vector<int> lines = asmer.source_lines();
+    vector<pair<int, Token> > symbols = asmer.symbols();
+
+    Simulator simulator;
+    Profile prof;
+    long long total = 0;
+    try
+    {
+        simulator.setMC(code.data(), code.size());
+        total = simulator.runObserved(prof, budget);
+    }
+    catch (runtime_error &e)
+    {
+        cerr << e.what();
+        cout << "stopped by a fault after ";
+    }
+    cout << total << " instructions" << (simulator.halted() ? ", machine halted" : "") << endl;
+
+    // annotated source: program words, with beq outcomes and, for data
+    // words, how often they were loaded and stored
+    printf("\n%12s %6s %10s %10s %10s %10s %6s  %s\n",
+           "count", "%", "taken", "not taken", "reads", "writes", "line", "source");
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        long long n = prof.count[pc];
+        printf("%12lld %6.2f ", n, percent(n, total));
+        if (n && ((code[pc] >> 22) & 0x7) == 4)
+            printf("%10lld %10lld ", prof.taken[pc], n - prof.taken[pc]);
+        else
+            printf("%10s %10s ", "", "");
+        if (prof.reads[pc] || prof.writes[pc])
+            printf("%10lld %10lld ", prof.reads[pc], prof.writes[pc]);
+        else
+            printf("%10s %10s ", "", "");
+        printf("%6d  %s\n", lines[pc], asmer.source(pc).str().c_str());
+    }
+
+    cout << "\nopcodes:" << endl;
+    for (int op = 0; op < 8; ++op)
+        if (prof.opcode[op])
+            printf("%12lld %6.2f  %s\n", prof.opcode[op], percent(prof.opcode[op], total), opcodes[op]);
+
+    // a label owns the words up to the next label
+    vector<pair<long long, string> > regions;
+    for (size_t i = 0; i < symbols.size(); ++i)
+    {
+        int from = max(symbols[i].first, 0);
+        int to = i + 1 < symbols.size() ? symbols[i + 1].first : code.size();
+        long long n = 0;
+        for (int pc = from; pc < to && pc < (int)code.size(); ++pc)
+            n += prof.count[pc];
+        if (n)
+            regions.push_back(make_pair(n, symbols[i].second.str()));
+    }
+    stable_sort(regions.begin(), regions.end(),
+                [](const pair<long long, string> &a, const pair<long long, string> &b)
+                { return a.first > b.first; });
+    cout << "\nlabels:" << endl;
+    for (auto &region: regions)
+        printf("%12lld %6.2f  %s\n", region.first, percent(region.first, total), region.second.c_str());
+
+    vector<pair<long long, pair<int, int> > > jumps;
+    for (auto &jump: prof.jumps)
+        jumps.push_back(make_pair(jump.second, jump.first));
+    stable_sort(jumps.begin(), jumps.end(),
+                [](const pair<long long, pair<int, int> > &a, const pair<long long, pair<int, int> > &b)
+                { return a.first > b.first; });
+    cout << "\njalr edges:" << endl;
+    for (auto &jump: jumps)
+        printf("%12lld  %s -> %s\n", jump.first,
+               symbolize(symbols, jump.second.first).c_str(),
+               symbolize(symbols, jump.second.second).c_str());
+
+    // everything past the program, usually the stack, in rows of 16 words
+    cout << "\nmemory past the program:" << endl;
+    printf("%12s %10s %10s\n", "address", "reads", "writes");
+    for (int row = code.size() & ~15; row < Simulator::MEMORY_WORDS; row += 16)
+    {
+        long long reads = 0, writes = 0;
+        for (int addr = max(row, (int)code.size()); addr < row + 16; ++addr)
+        {
+            reads += prof.reads[addr];
+            writes += prof.writes[addr];
+        }
+        if (reads || writes)
+            printf("%5d-%-6d %10lld %10lld\n", max(row, (int)code.size()), row + 15, reads, writes);
+    }
+    return simulator.halted() || budget >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int analyze(const string &filename)
+{
+    Assembler asmer;
+    if (!assemble(asmer, filename))
+        return EXIT_FAILURE;
+    const vector<Assembler::mc_t> &code = asmer.get_code();
+    vector<int> lines = asmer.source_lines();
+    vector<pair<int, Token> > symbols = asmer.symbols();
+    Simulator simulator;
+    simulator.setMC(code.data(), code.size());
+    LoopSkipper skipper(simulator);
+    const Analysis &analysis = skipper.analysis();
+
+    cout << "blocks:" << endl;
+    for (auto &block: analysis.blocks())
+    {
+        string range = symbolize(symbols, block.begin);
+        if (block.end - block.begin > 1)
+            range += ".." + symbolize(symbols, block.end - 1);
+        printf("    %-28s", range.c_str());
+        const char *sep = " -> ";
+        for (int s: block.succ)
+        {
+            printf("%s%s", sep, symbolize(symbols, analysis.blocks()[s].begin).c_str());
+            sep = ", ";
+        }
+        if (block.leaves)
+            printf("%soutside the program", sep);
+        else if (block.succ.empty())
+            printf("%s", block.indirect ? " -> return" : " -> halt");
+        printf("\n");
+    }
+
+    cout << "\ncallees:";
+    for (int target: analysis.indirectTargets())
+        cout << ' ' << symbolize(symbols, target);
+    cout << endl << "\nloops:" << endl;
+    for (size_t i = 0; i < analysis.loops().size(); ++i)
+    {
+        const Analysis::Loop &loop = analysis.loops()[i];
+        const LoopSummary &summary = skipper.summaries()[i];
+        string range = symbolize(symbols, loop.head) + ".." + symbolize(symbols, loop.latch);
+        printf("    %-28s %3d words, %s\n", range.c_str(), loop.size,
+               summary.ok() ? "closed form" : ("no closed form: " + summary.reason()).c_str());
+    }
+
+    // unreachable words are data unless their line is an instruction
+    cout << "\nunreachable code:" << endl;
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        if (analysis.reachable(pc))
+            continue;
+        istringstream in(asmer.source(pc).str());
+        string field;
+        bool data = false;
+        while (in >> field && !data)
+            data = field == ".fill";
+        if (!data)
+            printf("    %-28s %6d  %s\n", symbolize(symbols, pc).c_str(), lines[pc],
+                   asmer.source(pc).str().c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+// Address argument of a debugger command: a number or a label
+static bool parseAddress(const vector<pair<int, Token> > &symbols, const string &text, int &addr)
+{
+    for (auto &sym: symbols)
+        if (sym.second.str() == text)
+        {
+            addr = sym.first;
+            return true;
+        }
+    char *end;
+    long value = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end || value < 0 || value >= Simulator::MEMORY_WORDS)
+        return false;
+    addr = (int)value;
+    return true;
+}
+
+// Interactive reverse debugger over History: one command per line on
+// stdin, so it can be scripted too.
+static int debug(Simulator::Engine engine, const string &filename)
+{
+    Assembler asmer;
+    if (!assemble(asmer, filename))
+        return EXIT_FAILURE;
+    const vector<Assembler::mc_t> &code = asmer.get_code();
+    vector<int> lines = asmer.source_lines();
+    vector<pair<int, Token> > symbols = asmer.symbols();
+
+    Simulator simulator;
+    simulator.setEngine(engine);
+    simulator.setMC(code.data(), code.size());
+    History history(simulator);
+    const bool interactive = isatty(STDIN_FILENO);
+
+    auto where = [&]() {
+        int pc = simulator.pc();
+        printf("[%lld] pc %d %s", history.count(), pc, symbolize(symbols, pc).c_str());
+        if (pc >= 0 && pc < (int)code.size())
+            printf(" (line %d): %s", lines[pc], asmer.source(pc).str().c_str());
+        printf("%s\n", simulator.halted() ? "  [halted]" : "");
+    };
+    int at;
+    auto report = [&](History::Stop stop) {
+        switch (stop)
+        {
+            case History::STOP_BREAK: printf("breakpoint %s\n", symbolize(symbols, at).c_str()); break;
+            case History::STOP_WATCH:
+                printf("watch %s: mem[ %d ] %d\n", symbolize(symbols, at).c_str(), at, simulator.peek(at));
+                break;
+            case History::STOP_CHECKPOINT: printf("checkpoint reached\n"); break;
+            default: break;
+        }
+        where();
+    };
+
+    where();
+    string line;
+    while (true)
+    {
+        if (interactive)
+        {
+            printf("(lc2k) ");
+            fflush(stdout);
+        }
+        if (!getline(cin, line))
+            break;
+        istringstream in(line);
+        string command, arg;
+        in >> command >> arg;
+        long long n = arg.empty() ? 1 : atoll(arg.c_str());
+        int addr = 0;
+        try
+        {
+            if (command.empty())
+                continue;
+            else if (command == "q" || command == "quit")
+                break;
+            else if (command == "s" || command == "step")
+                report(history.proceed(n, at));
+            else if (command == "b" || command == "back")
+            {
+                while (n-- > 0 && history.back())
+                    ;
+                where();
+            }
+            else if (command == "c" || command == "continue")
+                report(history.proceed(-1, at));
+            else if (command == "rc" || command == "rcontinue")
+                report(history.reverse(at));
+            else if ((command == "g" || command == "goto") && !arg.empty() && n >= 0)
+            {
+                history.seek(n);
+                where();
+            }
+            else if (command == "ff" && !arg.empty() && n >= 0)
+            {
+                history.fastForward(n);
+                where();
+            }
+            else if ((command == "break" || command == "watch") && parseAddress(symbols, arg, addr))
+            {
+                (command == "break" ? history.breakpoints : history.watches).insert(addr);
+                printf("%s %s\n", command.c_str(), symbolize(symbols, addr).c_str());
+            }
+            else if (command == "delete")
+            {
+                history.breakpoints.clear();
+                history.watches.clear();
+            }
+            else if (command == "r" || command == "regs")
+            {
+                for (int r = 0; r < 8; ++r)
+                    printf("reg[ %d ] %d\n", r, simulator.reg(r));
+            }
+            else if (command == "x" && parseAddress(symbols, arg, addr))
+            {
+                string count;
+                in >> count;
+                for (int k = 0, m = count.empty() ? 1 : atoi(count.c_str());
+                     k < m && addr + k < Simulator::MEMORY_WORDS; ++k)
+                    printf("mem[ %d ] %d  %s\n", addr + k, simulator.peek(addr + k),
+                           symbolize(symbols, addr + k).c_str());
+            }
+            else if (command == "info")
+                printf("instruction %lld, checkpoint %lld, undo log %zu bytes\n",
+                       history.count(), history.checkpoint(), history.logBytes());
+            else
+                printf("commands: s [n], b [n], c, rc, g <count>, ff <n>, break <addr>, watch <addr>,\n"
+                       "          delete, r, x <addr> [n], info, q\n");
+        }
+        catch (runtime_error &e)
+        {
+            printf("fault: %s\n", e.what());
+            where();
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    string command = argv[1];
+    Simulator::Engine engine = Simulator::SWITCH;
+    Pipeline::Predictor predictor;
+    bool pipeline = false, engineSet = false;
+    string cache;
+    bool quiet = false;
+    long long budget = -1;
+    vector<string> files;
+    for (int i = 2; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "-q")
+            quiet = true;
+        else if (arg == "-n" && i + 1 < argc)
+            budget = atoll(argv[++i]);
+        else if (arg == "-e" && i + 1 < argc && Simulator::parseEngine(argv[i + 1], engine))
+            engineSet = true, ++i;
+        else if (arg == "-p" && i + 1 < argc && Pipeline::parsePredictor(argv[i + 1], predictor))
+            pipeline = true, ++i;
+        else if (arg == "-c" && i + 1 < argc)
+            cache = argv[++i];
+        else if (arg[0] != '-')
+            files.push_back(arg);
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    // -e, -p and -c each pick what runs the program
+    if (engineSet + pipeline + !cache.empty() > 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (command == "run" && files.size() == 1)
+        return run(engine, pipeline ? &predictor : NULL, cache.empty() ? NULL : &cache,
+                   quiet, budget, files[0]);
+    if (command == "check" && !files.empty() && !quiet)
+        return check(budget, files);
+    if (command == "profile" && files.size() == 1 && !quiet)
+        return profile(budget, files[0]);
+    if (command == "analyze" && files.size() == 1 && !quiet && budget < 0)
+        return analyze(files[0]);
+    if (command == "debug" && files.size() == 1 && !quiet && budget < 0)
+        return debug(engine, files[0]);
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}
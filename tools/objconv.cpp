@@ -0,0 +1,123 @@
+// Converts machine code between the decimal text format (one word per
+// line, what `assemble` writes by default) and the binary object format
+// of common/objfile.h. The direction follows the input file.
+//
+//   g++ -std=c++11 -O2 -o objconv objconv.cpp
+//   ./objconv prog.mc prog.obj      decimal -> object
+//   ./objconv prog.obj prog.mc      object -> decimal (symbols are dropped)
+//   ./objconv -s prog.obj           list the symbol table
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../common/mapfile.h"
+#include "../common/objfile.h"
+
+using namespace std;
+
+static int fail(const string &message)
+{
+    cerr << message << endl;
+    return EXIT_FAILURE;
+}
+
+static int parseObject(const MapFile &in, const char *filename, ObjImage &obj)
+{
+    switch (obj_parse(in.data, in.size, &obj))
+    {
+        case 0: return 0;
+        case -2: return fail(string("Unsupported object version: ") + filename);
+        default: return fail(string("Corrupt object file: ") + filename);
+    }
+}
+
+static int listSymbols(const MapFile &in, const char *filename)
+{
+    ObjImage obj;
+    if (!obj_is_object(in.data, in.size))
+        return fail(string("Not an object file: ") + filename);
+    if (parseObject(in, filename, obj))
+        return EXIT_FAILURE;
+    const unsigned char *p = obj.symbol;
+    for (unsigned i = 0; i < obj.symbols; ++i)
+    {
+        unsigned address, length;
+        const char *name;
+        p = obj_symbol(p, &address, &name, &length);
+        cout << address << '\t' << string(name, length) << '\n';
+    }
+    return EXIT_SUCCESS;
+}
+
+static int toText(const MapFile &in, const char *filename, const char *output)
+{
+    ObjImage obj;
+    if (parseObject(in, filename, obj))
+        return EXIT_FAILURE;
+    ofstream out(output);
+    for (unsigned i = 0; i < obj.words; ++i)
+        out << obj_word(&obj, i) << '\n';
+    if (!out.flush())
+        return fail(string("Failed when write to file: ") + output);
+    return EXIT_SUCCESS;
+}
+
+static int toObject(const MapFile &in, const char *filename, const char *output)
+{
+    vector<int> words;
+    const char *p = in.data, *end = p + in.size;
+    for (int lineno = 1; p != end; ++lineno)
+    {
+        const char *eol = mapfile_eol(p, end);
+        const char *q = mapfile_skip_space(p, eol);
+        int word;
+        if (q != eol)
+        {
+            q = mapfile_parse_int(q, eol, &word);
+            if (!q || mapfile_skip_space(q, eol) != eol)
+                return fail(string(filename) + ":" + to_string(lineno) + ": not a machine-code word");
+            words.push_back(word);
+        }
+        p = eol == end ? end : eol + 1;
+    }
+
+    vector<unsigned char> obj(obj_size(words.size(), 0, 0));
+    unsigned char *w = obj_begin(&obj[0], words.size(), 0);
+    for (size_t i = 0; i < words.size(); ++i, w += 4)
+        lc2k_put32(w, words[i]);
+    obj_seal(&obj[0], obj.size());
+
+    ofstream out(output, ios::binary);
+    if (!out.write((const char *)&obj[0], obj.size()))
+        return fail(string("Failed when write to file: ") + output);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    bool symbols = argc == 3 && string(argv[1]) == "-s";
+    if (argc != 3)
+    {
+        cerr << "Usage: " << argv[0] << " <input> <output>" << endl
+             << "       " << argv[0] << " -s <object file>" << endl;
+        return EXIT_FAILURE;
+    }
+    const char *input = argv[symbols ? 2 : 1];
+
+    MapFile in;
+    if (mapfile_open(&in, input) != 0)
+        return fail(string("Can not open file: ") + input);
+    int status;
+    if (symbols)
+        status = listSymbols(in, input);
+    else if (obj_is_object(in.data, in.size))
+        status = toText(in, input, argv[2]);
+    else
+        status = toObject(in, input, argv[2]);
+    mapfile_close(&in);
+    return status;
+}